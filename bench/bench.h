@@ -0,0 +1,121 @@
+#pragma once
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+class Runner {
+    using hr_clock = std::chrono::high_resolution_clock;
+
+    double min_time;
+    std::FILE* csv;
+
+   public:
+    /// Every result is also written as a row to csv if given, to compare
+    /// runs with compare.py.
+    explicit Runner(double min_time = 0.2, std::FILE* csv = nullptr)
+        : min_time(min_time), csv(csv) {
+        if (csv) {
+            fmt::print(csv,
+                       "name,ns_per_call,items_per_s,p50_ns,p99_ns,max_ns\n");
+        }
+    }
+
+    /// Calls fn until min_time has passed and reports the time per call.
+    /// items is the amount of work done by one call, e.g. the number of
+    /// vehicles stepped.
+    template <typename F>
+    void measure(const std::string& name, double items, F&& fn) {
+        auto iterations = 1ull;
+        double elapsed = 0;
+        while (true) {
+            const auto start = hr_clock::now();
+            for (auto i = 0ull; i < iterations; i++) {
+                fn();
+            }
+            elapsed =
+              std::chrono::duration<double>(hr_clock::now() - start).count();
+
+            if (elapsed >= min_time) break;
+            iterations *= 2;
+        }
+
+        const auto ns_per_call = elapsed * 1e9 / iterations;
+        const auto items_per_s = items * iterations / elapsed;
+        fmt::print("{:<40} {:>12.1f} ns/call {:>16.0f} items/s\n",
+                   name,
+                   ns_per_call,
+                   items_per_s);
+        if (csv) {
+            fmt::print(
+              csv, "{},{:.1f},{:.0f},,,\n", name, ns_per_call, items_per_s);
+        }
+    }
+
+    /// Times every one of samples calls of fn and reports the percentiles,
+    /// for operations where the tail matters more than the throughput.
+    template <typename F>
+    void latency(const std::string& name, std::size_t samples, F&& fn) {
+        std::vector<double> times(samples);
+        for (auto& time : times) {
+            const auto start = hr_clock::now();
+            fn();
+            time = std::chrono::duration<double, std::nano>(hr_clock::now() -
+                                                            start)
+                     .count();
+        }
+
+        std::sort(times.begin(), times.end());
+        fmt::print("{:<40} {:>12.1f} ns p50 {:>10.1f} ns p99 {:>10.1f} ns "
+                   "max\n",
+                   name,
+                   times[samples / 2],
+                   times[samples * 99 / 100],
+                   times.back());
+        if (csv) {
+            fmt::print(csv,
+                       "{},,,{:.1f},{:.1f},{:.1f}\n",
+                       name,
+                       times[samples / 2],
+                       times[samples * 99 / 100],
+                       times.back());
+        }
+    }
+};
+
+using Function = void (*)(Runner&);
+
+struct Benchmark {
+    const char* name;
+    Function function;
+};
+
+inline std::vector<Benchmark>& registry() {
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+struct Register {
+    Register(const char* name, Function function) {
+        registry().push_back({name, function});
+    }
+};
+
+/// Prevents the compiler from optimizing away a result.
+template <typename T>
+void keep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+}  // namespace bench
+
+#define BENCHMARK(name)                                       \
+    static void name(bench::Runner& runner);                  \
+    static const bench::Register name##_register(#name, name); \
+    static void name(bench::Runner& runner)
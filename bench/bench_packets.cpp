@@ -0,0 +1,133 @@
+#include "bench.h"
+
+#include "osd.h"
+#include "transport.h"
+
+#include <array>
+#include <cstring>
+#include <string>
+
+namespace {
+/// Keeps the last packet, so encoding into it isn't optimized away.
+class BufferTransport : public Transport {
+    alignas(8) std::array<std::byte, 4096> buffer;
+
+   public:
+    std::optional<View> recv() override {
+        return std::nullopt;
+    }
+
+    void send(const std::byte* data, std::size_t len) override {
+        std::memcpy(buffer.data(), data, len);
+    }
+
+    std::byte* reserve(std::size_t) override {
+        return buffer.data();
+    }
+
+    void commit() override {
+        bench::keep(buffer);
+    }
+};
+
+template <typename T>
+void parse_benchmarks(bench::Runner& runner, const std::string& name) {
+    const T packet{};
+    std::array<std::byte, sizeof(T)> data;
+    std::memcpy(data.data(), &packet, sizeof(T));
+
+    runner.measure(name + "/parse", 1, [&] {
+        bench::keep(data);
+        auto* cur = data.data();
+        auto len = data.size();
+        bench::keep(parse<T>(cur, len));
+    });
+
+    runner.measure(name + "/decode", 1, [&] {
+        bench::keep(data);
+        T decoded;
+        bench::keep(decode(data.data(), data.size(), decoded));
+        bench::keep(decoded);
+    });
+}
+/// A flight screen where the timer and the voltage change, sent as delta
+/// updates. Reports the size of a keyframe and of a delta.
+void osd_delta_benchmarks(bench::Runner& runner,
+                          Transport& transport,
+                          const std::string& name,
+                          uint32_t columns,
+                          uint32_t rows) {
+    // In the rows of the largest canvas, as the fake display port.
+    std::array<uint8_t, MaxOsdSize> screen;
+    screen.fill(' ');
+    auto* voltage = &screen[1 * MaxOsdColumns + 1];
+    auto* timer = &screen[(rows - 2) * MaxOsdColumns + columns - 8];
+    std::memcpy(voltage, "16.4V", 5);
+    std::memcpy(timer, "00:00", 5);
+    const auto dirty_rows = 1u << 1 | 1u << (rows - 2);
+
+    OsdDelta delta(columns, rows);
+    StateOsdDeltaPacket update;
+    update.cells._len = uint32_t(
+      delta.keyframe(screen.data(), MaxOsdColumns, &update.cells.value[0]));
+    const auto keyframe_bytes = send_size(update);
+
+    auto frame = 0u;
+    std::size_t delta_bytes = 0;
+    runner.measure(name + "/delta", 1, [&] {
+        frame++;
+        timer[4] = uint8_t('0' + frame % 10);
+        voltage[3] = uint8_t('0' + frame / 7 % 10);
+
+        const auto len = delta.encode(
+          screen.data(), MaxOsdColumns, dirty_rows, &update.cells.value[0]);
+        update.angularVelocity.value = {1, 2, 3};
+        update.linearVelocity.value = {1, 2, 3};
+        update.cells._len = uint32_t(len.value_or(0));
+        delta_bytes = send_size(update);
+        transport.send(reinterpret_cast<const std::byte*>(&update),
+                       delta_bytes);
+    });
+
+    fmt::print("{:<40} {:>12} bytes keyframe {:>6} bytes delta\n",
+               name + "/size",
+               keyframe_bytes,
+               delta_bytes);
+}
+}  // namespace
+
+BENCHMARK(packets) {
+    parse_benchmarks<InitPacket>(runner, "packets/init");
+    parse_benchmarks<StatePacket>(runner, "packets/state");
+    parse_benchmarks<BatchStatePacket>(runner, "packets/batch_state");
+
+    BatchStatePacket batch;
+    auto* data = reinterpret_cast<std::byte*>(&batch);
+    runner.measure("packets/get_any", 1, [&] {
+        bench::keep(batch);
+        bench::keep(get_any<StatePacket, BatchStatePacket, ControlPacket>(
+          data, sizeof(batch)));
+    });
+
+    BufferTransport transport;
+    const vmath::vec3 velocity = {1, 2, 3};
+
+    runner.measure("packets/osd_update/copy", 1, [&] {
+        StateOsdUpdatePacket update;
+        update.angularVelocity.value = velocity;
+        update.linearVelocity.value = velocity;
+        update.osd.value.fill(' ');
+        send(transport, update);
+    });
+
+    runner.measure("packets/osd_update/in_place", 1, [&] {
+        auto& update = emplace<StateOsdUpdatePacket>(transport);
+        update.angularVelocity.value = velocity;
+        update.linearVelocity.value = velocity;
+        update.osd.value.fill(' ');
+        transport.commit();
+    });
+
+    osd_delta_benchmarks(runner, transport, "packets/osd_update/sd", 30, 16);
+    osd_delta_benchmarks(runner, transport, "packets/osd_update/hd", 60, 22);
+}
@@ -0,0 +1,276 @@
+#include "bench.h"
+
+#include "airframes.h"
+#include "batch_physics.h"
+#include "simulator.h"
+
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+extern "C" int16_t motorsPwm[];
+
+#ifndef M_PI
+#define M_PI 3.14159265358979
+#endif
+
+namespace {
+const auto DT = 50e-6f;
+
+StatePacket hover_state() {
+    StatePacket state;
+    state.rotation.value = vmath::identity;
+    state.angularVelocity = vmath::vec3{0.1f, 0.2f, 0.0f};
+    state.linearVelocity = vmath::vec3{1.0f, 0.0f, 2.0f};
+    return state;
+}
+
+/// Exposes the scalar physics of the simulator.
+class ScalarSimulator : public Simulator {
+   public:
+    explicit ScalarSimulator(const InitPacket& init)
+        : Simulator(std::make_unique<NullTransport>()) {
+        init_packet = init;
+        airframe = Airframe(init);
+    }
+
+    using Simulator::calculate_motors;
+    using Simulator::calculate_physics;
+};
+
+/// Hands the simulator the same state packet forever and drops its updates.
+class LoopTransport : public Transport {
+    alignas(8) std::array<std::byte, sizeof(StatePacket)> packet;
+
+   public:
+    explicit LoopTransport(StatePacket state) {
+        std::memcpy(packet.data(), &state, sizeof(state));
+    }
+
+    std::optional<View> recv() override {
+        return View{packet.data(), packet.size()};
+    }
+
+    void send(const std::byte* data, std::size_t) override {
+        bench::keep(data);
+    }
+};
+
+/// A simulator with betaflight initialized and its serial ports disabled,
+/// so nothing touches the network.
+class LoopSimulator : public Simulator {
+   public:
+    explicit LoopSimulator(const StatePacket& state)
+        : Simulator(std::make_unique<LoopTransport>(state)) {
+        init(quad_airframe());
+        serial_enabled = false;
+    }
+
+    using Simulator::calculate_motors;
+    using Simulator::calculate_physics;
+    using Simulator::rk4_step;
+    using Simulator::update_rotation;
+    using Simulator::update_sensors;
+};
+
+const std::size_t VEHICLE_COUNTS[] = {1, 64, 1024};
+}  // namespace
+
+BENCHMARK(physics_scalar) {
+    const auto init_packet = quad_airframe();
+    ScalarSimulator simulator(init_packet);
+
+    for (auto i = 0; i < 4; i++) {
+        motorsPwm[i] = 400;
+    }
+
+    for (const auto count : VEHICLE_COUNTS) {
+        std::vector<Simulator::Body> bodies(
+          count, Simulator::Body::from_state(hover_state()));
+        std::vector<Simulator::Motors> motors(count);
+        for (auto& vehicle : motors) {
+            for (auto i = 0u; i < 4; i++) {
+                vehicle[i].position = init_packet.quad_motor_pos.value[i].value;
+            }
+        }
+
+        runner.measure(fmt::format("physics_scalar/{}", count), count, [&]() {
+            for (auto i = 0u; i < count; i++) {
+                const auto torque =
+                  simulator.calculate_motors<4>(DT, bodies[i], motors[i]);
+                bench::keep(simulator.calculate_physics<4>(
+                  DT, bodies[i], motors[i], torque));
+            }
+        });
+    }
+}
+
+BENCHMARK(physics_batch) {
+    const auto init_packet = quad_airframe();
+
+    for (const auto count : VEHICLE_COUNTS) {
+        BatchPhysics physics(init_packet, count);
+        for (auto i = 0u; i < count; i++) {
+            physics.set_state(i, hover_state());
+            physics.set_motors(i, {400, 400, 400, 400});
+        }
+
+        runner.measure(fmt::format("physics_batch/{}", count), count, [&]() {
+            physics.step(DT);
+            bench::keep(physics);
+        });
+    }
+}
+
+BENCHMARK(simulator) {
+    auto state = hover_state();
+    // A 60 Hz game frame.
+    state.delta = 1 / 60.0f;
+
+    LoopSimulator simulator(state);
+    auto body = Simulator::Body::from_state(state);
+
+    Simulator::Motors motors;
+    for (auto i = 0u; i < 4; i++) {
+        motors[i].position = quad_airframe().quad_motor_pos.value[i].value;
+        motorsPwm[i] = 400;
+    }
+
+    runner.measure("simulator/calculate_motors", 1, [&] {
+        bench::keep(simulator.calculate_motors<4>(DT, body, motors));
+    });
+
+    runner.measure("simulator/calculate_physics", 1, [&] {
+        bench::keep(simulator.calculate_physics<4>(DT, body, motors, 0.01f));
+    });
+
+    runner.measure("simulator/rk4_step", 1, [&] {
+        float error;
+        bench::keep(simulator.rk4_step<4>(DT, body, motors, error));
+    });
+
+    auto rotating = Simulator::Body::from_state(hover_state());
+    runner.measure("simulator/update_rotation", 1, [&] {
+        LoopSimulator::update_rotation(DT, rotating);
+        bench::keep(rotating);
+    });
+
+    // One scheduler tick each, so the sensors come due at their rates.
+    const vmath::vec3 acceleration = {0, 9.81f, 0};
+    runner.measure("simulator/update_sensors", 1, [&] {
+        bench::keep(body);
+        simulator.micros_passed += 50;
+        simulator.update_sensors(state.position.value, body, acceleration);
+    });
+
+    runner.measure("simulator/step", 1, [&] { bench::keep(simulator.step()); });
+
+    simulator.physics.integrator = Simulator::Integrator::Rk4;
+    runner.measure("simulator/step_rk4", 1, [&] {
+        bench::keep(simulator.step());
+    });
+}
+
+/// The attitude math of one physics tick, with the rotation kept as a basis
+/// (as before the simulator switched to quaternions) and as a quaternion.
+BENCHMARK(attitude) {
+    using namespace vmath;
+
+    const auto init_packet = quad_airframe();
+    const auto state = hover_state();
+    const vec3 inv_inertia = init_packet.quad_inv_inertia.value;
+    const vec3 moment = {0.01f, 0.02f, 0.03f};
+    const vec3 acceleration = {0, 9.81f, 0};
+
+    mat3 basis = state.rotation.value;
+    const vec3 angular_velocity = state.angularVelocity.value;
+    runner.measure("attitude/basis", 1, [&] {
+        const auto w = angular_velocity * DT;
+        const mat3 W = {
+          vec3{1, -w[2], w[1]}, vec3{w[2], 1, -w[0]}, vec3{-w[1], w[0], 1}};
+        basis = W * basis;
+
+        mat3 inv_tensor = {vec3{inv_inertia[0], 0, 0},
+                           vec3{0, inv_inertia[1], 0},
+                           vec3{0, 0, inv_inertia[2]}};
+        inv_tensor = basis * inv_tensor * transpose(basis);
+        bench::keep(xform(inv_tensor, xform(basis, moment)));
+
+        bench::keep(mat3_to_quat(basis));
+        bench::keep(xform_inv(basis, angular_velocity));
+        bench::keep(xform_inv(basis, acceleration));
+        bench::keep(basis);
+    });
+
+    quat rotation = mat3_to_quat(state.rotation.value);
+    runner.measure("attitude/quat", 1, [&] {
+        rotation = vmath::integrate(rotation, angular_velocity, DT);
+
+        bench::keep(rotate(rotation, inv_inertia * moment));
+
+        bench::keep(rotation);
+        bench::keep(rotate_inv(rotation, angular_velocity));
+        bench::keep(rotate_inv(rotation, acceleration));
+    });
+}
+
+/// One gyro sample of broadband noise and quad vibration with 3 harmonics,
+/// drawn and filtered per sample with a sine per oscillator, and from the
+/// precomputed ring with the SIMD oscillators of GyroNoise.
+BENCHMARK(gyro_noise) {
+    GyroNoise::Options options;
+    options.noise_dps = 2;
+    options.vibration_dps = 10;
+    options.harmonics = 3;
+
+    const auto init_packet = quad_airframe();
+    std::array<float, MaxMotors> rpm{};
+    for (auto i = 0u; i < 4; i++) rpm[i] = 20000 + 1000.0f * i;
+
+    std::mt19937 rng(options.seed);
+    std::normal_distribution<float> normal;
+    // Butterworth lowpass at 250 Hz for 20 kHz.
+    const float b0 = 0.00146f, a1 = -1.8890f, a2 = 0.8949f;
+    std::array<vmath::vec3, 3> x{}, y{};
+    std::array<float, 4 * 3> phase{};
+    const auto max_rpm = init_packet.prop_max_rpm.value;
+    runner.measure("gyro_noise/direct", 1, [&] {
+        vmath::vec3 n;
+        for (auto j = 0u; j < 3; j++) {
+            x[0][j] = normal(rng);
+            y[0][j] = b0 * (x[0][j] + 2 * x[1][j] + x[2][j]) -
+                      a1 * y[1][j] - a2 * y[2][j];
+            n[j] = y[0][j] * options.noise_dps;
+        }
+        x[2] = x[1];
+        x[1] = x[0];
+        y[2] = y[1];
+        y[1] = y[0];
+
+        for (auto i = 0u; i < phase.size(); i++) {
+            const auto motor = i / 3;
+            const auto harmonic = float(i % 3 + 1);
+            const auto& pos = init_packet.quad_motor_pos.value[motor].value;
+            phase[i] = std::fmod(
+              phase[i] + rpm[motor] * harmonic / 60e6f * 50, 1.0f);
+            const auto amplitude = options.vibration_dps / harmonic *
+                                   rpm[motor] * rpm[motor] /
+                                   (max_rpm * max_rpm) *
+                                   std::sin(2 * float(M_PI) * phase[i]);
+            n[0] += amplitude * pos[2];
+            n[1] += amplitude * 0.25f;
+            n[2] -= amplitude * pos[0];
+        }
+        bench::keep(n);
+    });
+
+    GyroNoise noise;
+    noise.configure(options, init_packet, 20000);
+    uint64_t now = 0;
+    runner.measure("gyro_noise/precomputed", 1, [&] {
+        now += 50;
+        bench::keep(noise.sample(now, rpm));
+    });
+}
@@ -0,0 +1,85 @@
+#include "bench.h"
+
+#include <array>
+#include <cstdint>
+
+extern "C" {
+#include "dyad.h"
+}
+
+namespace bf {
+extern "C" {
+#include "drivers/serial.h"
+#include "drivers/serial_tcp.h"
+
+#include "src/target.h"
+}
+}  // namespace bf
+
+namespace {
+/// An MSP v1 response with a 64 byte payload.
+std::array<uint8_t, 6 + 64> msp_response() {
+    std::array<uint8_t, 6 + 64> frame;
+    frame[0] = '$';
+    frame[1] = 'M';
+    frame[2] = '>';
+    frame[3] = 64;
+    frame[4] = 108;  // MSP_ATTITUDE
+    uint8_t checksum = frame[3] ^ frame[4];
+    for (auto i = 5u; i < frame.size() - 1; i++) {
+        frame[i] = uint8_t(i);
+        checksum ^= frame[i];
+    }
+    frame.back() = checksum;
+    return frame;
+}
+}  // namespace
+
+/// MSP responses written to a UART with a client, byte by byte with a
+/// dyad_write each as before the tx buffer was coalesced, and as
+/// serialWriteBuf with one flush per scheduler pass. items/s are bytes.
+BENCHMARK(serial) {
+    using namespace bf;
+
+    // The last UART, betaflight doesn't use it.
+    const auto id = SERIAL_PORT_COUNT - 1;
+    dyad_init();
+    dyad_setUpdateTimeout(0);
+    auto* port = serTcpOpen(
+      id, nullptr, nullptr, 115200, MODE_RXTX, SERIAL_NOT_INVERTED);
+    auto* tcp = reinterpret_cast<tcpPort_t*>(port);
+
+    std::array<tcpConnection_t, SERIAL_PORT_COUNT> connections;
+    tcpGetConnections(&connections[0]);
+    const auto saved = connections[id];
+
+    // The client is a stream that is never connected, it keeps everything
+    // written to it. dyad_update frees it, so it is replaced now and then.
+    auto responses = 0u;
+    auto reconnect = [&] {
+        if (responses++ % 1024 != 0) return;
+        dyad_update();
+        connections[id].conn = dyad_newStream();
+        tcpSetConnections(&connections[0]);
+    };
+
+    const auto frame = msp_response();
+    runner.measure("serial/msp_response/per_byte", frame.size(), [&] {
+        reconnect();
+        for (const auto byte : frame) {
+            port->vTable->serialWrite(port, byte);
+            tcpDataOut(tcp);
+        }
+    });
+
+    responses = 0;
+    runner.measure("serial/msp_response/coalesced", frame.size(), [&] {
+        reconnect();
+        port->vTable->writeBuf(port, frame.data(), int(frame.size()));
+        tcpFlush();
+    });
+
+    dyad_update();
+    connections[id] = saved;
+    tcpSetConnections(&connections[0]);
+}
@@ -0,0 +1,95 @@
+#include "bench.h"
+
+#include "mmsg_transport.h"
+#include "shm_transport.h"
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+const std::size_t SAMPLES = 20000;
+
+const std::byte STOP[] = {
+  std::byte('S'), std::byte('T'), std::byte('O'), std::byte('P')};
+
+/// Round trip of a state packet through an echo thread, like a frame
+/// between the game and the simulator.
+void round_trip(bench::Runner& runner,
+                const std::string& name,
+                Transport& game,
+                Transport& simulator) {
+    std::thread echo([&simulator] {
+        while (auto view = simulator.recv()) {
+            auto [data, len] = *view;
+            if (is_stop(data, len)) break;
+            simulator.send(data, len);
+        }
+    });
+
+    StatePacket state;
+    runner.latency(name, SAMPLES, [&] {
+        send(game, state);
+        bench::keep(game.recv());
+    });
+
+    game.send(STOP, sizeof(STOP));
+    game.flush();
+    echo.join();
+}
+}  // namespace
+
+BENCHMARK(transport_latency) {
+    {
+        UdpTransport simulator(17777, 16666);
+        UdpTransport game(16666, 17777);
+        round_trip(runner, "transport_latency/udp", game, simulator);
+    }
+
+    // Busy polling only pays off with a free cpu for the game side.
+    const auto busy_polls = std::thread::hardware_concurrency() > 1
+                              ? std::vector<int>{0, 50}
+                              : std::vector<int>{0};
+    for (const auto busy_poll : busy_polls) {
+        MmsgTransport simulator(
+          17777, 16666, std::chrono::microseconds(busy_poll));
+        MmsgTransport game(16666, 17777);
+        if (!simulator.valid() || !game.valid()) {
+            fmt::print("transport_latency/mmsg: not supported\n");
+            break;
+        }
+
+        const auto name = busy_poll ? "transport_latency/mmsg_busy_poll"
+                                    : "transport_latency/mmsg";
+        round_trip(runner, name, game, simulator);
+
+        const auto& wakeup = simulator.wakeup_latency();
+        fmt::print("{:<40} {:>12.1f} ns p50 {:>10.1f} ns p99 {:>10.1f} ns "
+                   "max\n",
+                   std::string(name) + "/wakeup",
+                   double(wakeup.percentile(0.5)),
+                   double(wakeup.percentile(0.99)),
+                   double(wakeup.max()));
+    }
+
+    for (const auto futex : {true, false}) {
+        if (!futex && std::thread::hardware_concurrency() < 2) {
+            continue;
+        }
+
+        ShmTransport simulator(
+          "/kwadsim_bench", ShmTransport::Side::Simulator, futex);
+        ShmTransport game("/kwadsim_bench", ShmTransport::Side::Game, futex);
+        if (!simulator.valid() || !game.valid()) {
+            fmt::print("transport_latency/shm: not supported\n");
+            return;
+        }
+
+        round_trip(runner,
+                   futex ? "transport_latency/shm_futex"
+                         : "transport_latency/shm_spin",
+                   game,
+                   simulator);
+    }
+}
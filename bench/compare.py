@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+"""Compares two `benchmarks --csv` results, exits with 1 on a regression.
+
+usage: compare.py baseline.csv current.csv [threshold]
+
+threshold is the allowed slowdown, 0.1 (10%) by default. Throughput
+benchmarks compare ns per call, latency benchmarks the p99.
+"""
+
+import csv
+import sys
+
+
+def load(path):
+    with open(path, newline="") as file:
+        results = {}
+        for row in csv.DictReader(file):
+            time = row["ns_per_call"] or row["p99_ns"]
+            results[row["name"]] = float(time)
+        return results
+
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        print(__doc__.strip().splitlines()[2])
+        return 2
+
+    baseline = load(sys.argv[1])
+    current = load(sys.argv[2])
+    threshold = float(sys.argv[3]) if len(sys.argv) == 4 else 0.1
+
+    regressions = 0
+    for name, time in current.items():
+        if name not in baseline:
+            print(f"{name:<40} {time:>12.1f} ns (new)")
+            continue
+
+        change = time / baseline[name] - 1
+        mark = ""
+        if change > threshold:
+            mark = " REGRESSION"
+            regressions += 1
+        print(f"{name:<40} {time:>12.1f} ns {change:>+8.1%}{mark}")
+
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
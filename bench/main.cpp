@@ -0,0 +1,37 @@
+#include "bench.h"
+
+#include <cstdio>
+#include <cstring>
+
+int main(int argc, char** argv) {
+    const char* filter = nullptr;
+    std::FILE* csv = nullptr;
+
+    for (auto i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv = std::fopen(argv[++i], "w");
+            if (!csv) {
+                fmt::print("Failed to open {}\n", argv[i]);
+                return 1;
+            }
+        } else if (filter == nullptr && argv[i][0] != '-') {
+            filter = argv[i];
+        } else {
+            fmt::print("usage: {} [--csv results.csv] [filter]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bench::Runner runner(0.2, csv);
+
+    for (const auto& benchmark : bench::registry()) {
+        if (filter && std::strstr(benchmark.name, filter) == nullptr) {
+            continue;
+        }
+        benchmark.function(runner);
+    }
+
+    if (csv) std::fclose(csv);
+
+    return 0;
+}
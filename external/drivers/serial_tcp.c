@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "platform.h"
 
@@ -40,13 +41,40 @@
 
 #define BASE_PORT 5760
 
+// Written bytes wait in the tx buffer until the simulator calls tcpFlush
+// after a scheduler pass, or until this many are waiting.
+#define TX_FLUSH_WATERMARK (TX_BUFFER_SIZE / 2)
+
 static const struct serialPortVTable tcpVTable;  // Forward
 static tcpPort_t tcpSerialPorts[SERIAL_PORT_COUNT];
 static bool tcpPortInitialized[SERIAL_PORT_COUNT];
 static bool tcpStart = false;
+static uint16_t tcpBasePort = BASE_PORT;
+// One bit per port with bytes in its tx buffer.
+static uint32_t tcpTxPending;
+
+_Static_assert(SERIAL_PORT_COUNT <= 32, "tcpTxPending has a bit per port");
+
 bool tcpIsStart(void) {
     return tcpStart;
 }
+void tcpSetBasePort(uint16_t port) {
+    tcpBasePort = port;
+}
+void tcpGetConnections(tcpConnection_t *connections) {
+    for (int i = 0; i < SERIAL_PORT_COUNT; i++) {
+        connections[i].conn = tcpSerialPorts[i].conn;
+        connections[i].connected = tcpSerialPorts[i].connected;
+        connections[i].clientCount = tcpSerialPorts[i].clientCount;
+    }
+}
+void tcpSetConnections(const tcpConnection_t *connections) {
+    for (int i = 0; i < SERIAL_PORT_COUNT; i++) {
+        tcpSerialPorts[i].conn = connections[i].conn;
+        tcpSerialPorts[i].connected = connections[i].connected;
+        tcpSerialPorts[i].clientCount = connections[i].clientCount;
+    }
+}
 static void onData(dyad_Event *e) {
     tcpPort_t *s = (tcpPort_t *)(e->udata);
     tcpDataIn(s, (uint8_t *)e->data, e->size);
@@ -97,15 +125,15 @@ static tcpPort_t *tcpReconfigure(tcpPort_t *s, int id) {
     dyad_setNoDelay(s->serv, 1);
     dyad_addListener(s->serv, DYAD_EVENT_ACCEPT, onAccept, s);
 
-    if (dyad_listenEx(s->serv, "127.0.0.1", BASE_PORT + id + 1, 10) == 0) {
+    if (dyad_listenEx(s->serv, "127.0.0.1", tcpBasePort + id + 1, 10) == 0) {
         fprintf(stderr,
                 "bind port %u for UART%u\n",
-                (unsigned)BASE_PORT + id + 1,
+                (unsigned)tcpBasePort + id + 1,
                 (unsigned)id + 1);
     } else {
         fprintf(stderr,
                 "bind port %u for UART%u failed!!\n",
-                (unsigned)BASE_PORT + id + 1,
+                (unsigned)tcpBasePort + id + 1,
                 (unsigned)id + 1);
     }
     return s;
@@ -162,17 +190,16 @@ uint32_t tcpTotalRxBytesWaiting(const serialPort_t *instance) {
     return count;
 }
 
-uint32_t tcpTotalTxBytesFree(const serialPort_t *instance) {
-    tcpPort_t *s = (tcpPort_t *)instance;
-    uint32_t bytesUsed;
-
+static uint32_t tcpTxBytesUsed(const tcpPort_t *s) {
     if (s->port.txBufferHead >= s->port.txBufferTail) {
-        bytesUsed = s->port.txBufferHead - s->port.txBufferTail;
-    } else {
-        bytesUsed =
-          s->port.txBufferSize + s->port.txBufferHead - s->port.txBufferTail;
+        return s->port.txBufferHead - s->port.txBufferTail;
     }
-    uint32_t bytesFree = (s->port.txBufferSize - 1) - bytesUsed;
+    return s->port.txBufferSize + s->port.txBufferHead - s->port.txBufferTail;
+}
+
+uint32_t tcpTotalTxBytesFree(const serialPort_t *instance) {
+    tcpPort_t *s = (tcpPort_t *)instance;
+    uint32_t bytesFree = (s->port.txBufferSize - 1) - tcpTxBytesUsed(s);
 
     return bytesFree;
 }
@@ -180,6 +207,10 @@ uint32_t tcpTotalTxBytesFree(const serialPort_t *instance) {
 bool isTcpTransmitBufferEmpty(const serialPort_t *instance) {
     tcpPort_t *s = (tcpPort_t *)instance;
 
+    // Betaflight waits for this in a loop that only advances simulated time,
+    // so the bytes held back for tcpFlush are sent now.
+    if (tcpTxPending & (1u << s->id)) tcpDataOut(s);
+
     bool isEmpty = s->port.txBufferTail == s->port.txBufferHead;
 
     return isEmpty;
@@ -209,13 +240,49 @@ void tcpWrite(serialPort_t *instance, uint8_t ch) {
         s->port.txBufferHead++;
     }
 
-    tcpDataOut(s);
+    tcpTxPending |= 1u << s->id;
+    if (tcpTxBytesUsed(s) >= TX_FLUSH_WATERMARK) tcpDataOut(s);
+}
+
+static void tcpWriteBuf(serialPort_t *instance, const void *data, int count) {
+    tcpPort_t *s = (tcpPort_t *)instance;
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    while (count > 0) {
+        // Up to the end of the buffer, and never onto bytes not yet sent.
+        int chunk = s->port.txBufferSize - s->port.txBufferHead;
+        int room = (int)tcpTotalTxBytesFree(instance);
+        if (chunk > room) chunk = room;
+        if (chunk > count) chunk = count;
+        if (chunk == 0) {
+            tcpDataOut(s);
+            // Dropped like on a full UART if nobody is connected.
+            if (tcpTotalTxBytesFree(instance) == 0) return;
+            continue;
+        }
+
+        memcpy((uint8_t *)&s->port.txBuffer[s->port.txBufferHead],
+               bytes,
+               chunk);
+        s->port.txBufferHead += chunk;
+        if (s->port.txBufferHead >= s->port.txBufferSize) {
+            s->port.txBufferHead = 0;
+        }
+        bytes += chunk;
+        count -= chunk;
+    }
+
+    tcpTxPending |= 1u << s->id;
+    if (tcpTxBytesUsed(s) >= TX_FLUSH_WATERMARK) tcpDataOut(s);
 }
 
 void tcpDataOut(tcpPort_t *instance) {
     tcpPort_t *s = (tcpPort_t *)instance;
     if (s->conn == NULL) return;
+    tcpTxPending &= ~(1u << s->id);
 
+    // dyad buffers the writes and sends them together on the next
+    // dyad_update, so this is at most two appends for the whole buffer.
     if (s->port.txBufferHead < s->port.txBufferTail) {
         // send data till end of buffer
         int chunk = s->port.txBufferSize - s->port.txBufferTail;
@@ -232,6 +299,13 @@ void tcpDataOut(tcpPort_t *instance) {
     s->port.txBufferTail = s->port.txBufferHead;
 }
 
+void tcpFlush(void) {
+    const uint32_t pending = tcpTxPending;
+    for (int id = 0; id < SERIAL_PORT_COUNT; id++) {
+        if (pending & (1u << id)) tcpDataOut(&tcpSerialPorts[id]);
+    }
+}
+
 void tcpDataIn(tcpPort_t *instance, uint8_t *ch, int size) {
     tcpPort_t *s = (tcpPort_t *)instance;
 
@@ -257,7 +331,7 @@ static const struct serialPortVTable tcpVTable = {
   .setMode = NULL,
   .setCtrlLineStateCb = NULL,
   .setBaudRateCb = NULL,
-  .writeBuf = NULL,
+  .writeBuf = tcpWriteBuf,
   .beginWrite = NULL,
   .endWrite = NULL,
 };
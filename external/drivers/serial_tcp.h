@@ -51,7 +51,23 @@ serialPort_t *serTcpOpen(int id,
 // tcpPort API
 void tcpDataIn(tcpPort_t *instance, uint8_t *ch, int size);
 void tcpDataOut(tcpPort_t *instance);
+// Hands the bytes written since the last call to dyad, the simulator calls
+// it after every scheduler pass.
+void tcpFlush(void);
+
+// Client connections belong to the host, so they are kept when the
+// simulator restores a snapshot of the betaflight memory.
+typedef struct {
+    dyad_Stream *conn;
+    bool connected;
+    uint16_t clientCount;
+} tcpConnection_t;
+
+void tcpGetConnections(tcpConnection_t *connections);
+void tcpSetConnections(const tcpConnection_t *connections);
 
 bool tcpIsStart(void);
+// UARTn listens on port + n, must be called before the ports are opened.
+void tcpSetBasePort(uint16_t port);
 bool *tcpGetUsed(void);
 tcpPort_t *tcpGetPool(void);
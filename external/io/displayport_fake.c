@@ -7,10 +7,21 @@
 #include "drivers/display.h"
 #include "common/utils.h"
 
-uint8_t osdScreen[VIDEO_LINES][CHARS_PER_LINE];
+uint8_t osdScreen[MAX_VIDEO_LINES][MAX_CHARS_PER_LINE];
+uint32_t osdDirtyRows;
+
+_Static_assert(MAX_VIDEO_LINES <= 32, "osdDirtyRows has a bit per line");
+
+// The canvas betaflight draws on, the top left of osdScreen.
+static uint8_t canvasColumns = CHARS_PER_LINE;
+static uint8_t canvasRows = VIDEO_LINES;
+
+#define ALL_ROWS ((uint32_t)((1ull << canvasRows) - 1))
 
 // osd:
-static uint8_t osdBackBuffer[VIDEO_LINES][CHARS_PER_LINE];
+static uint8_t osdBackBuffer[MAX_VIDEO_LINES][MAX_CHARS_PER_LINE];
+// Rows of osdBackBuffer written since the last drawScreen.
+static uint32_t backDirtyRows;
 static displayPort_t fakeDisplayPort;
 
 extern unsigned int resumeRefreshAt;
@@ -30,30 +41,43 @@ static int release(displayPort_t *displayPort) {
 
 static int clearScreen(displayPort_t *displayPort) {
     UNUSED(displayPort);
-    memset(osdBackBuffer, 0, 16 * 30);
+    memset(osdBackBuffer, 0, sizeof(osdBackBuffer));
+    backDirtyRows = ALL_ROWS;
     return 0;
 }
 
 static int drawScreen(displayPort_t *displayPort) {
     UNUSED(displayPort);
-    memcpy(osdScreen, osdBackBuffer, 16 * 30);
+    // The OSD rewrites most elements on every draw, only rows that really
+    // changed are copied and marked for the simulator.
+    for (int y = 0; backDirtyRows; y++) {
+        const uint32_t bit = 1u << y;
+        if (!(backDirtyRows & bit)) continue;
+        backDirtyRows &= ~bit;
+
+        if (memcmp(osdScreen[y], osdBackBuffer[y], canvasColumns) != 0) {
+            memcpy(osdScreen[y], osdBackBuffer[y], canvasColumns);
+            osdDirtyRows |= bit;
+        }
+    }
     return 0;
 }
 
 static int screenSize(const displayPort_t *displayPort) {
     UNUSED(displayPort);
-    return 480;
+    return canvasRows * canvasColumns;
 }
 
 static int writeString(displayPort_t *displayPort, uint8_t x, uint8_t y,
                        const char *s) {
     UNUSED(displayPort);
     // printf("%d, %d: %s\n", x, y, s);
-    if (y < VIDEO_LINES) {
-        for (int i = 0; s[i] && x + i < CHARS_PER_LINE; i++) {
+    if (y < canvasRows) {
+        for (int i = 0; s[i] && x + i < canvasColumns; i++) {
             osdBackBuffer[y][x + i] = s[i];
             // printf("%d, %d: %d\n", x, y, s[i]);
         }
+        backDirtyRows |= 1u << y;
     }
     return 0;
 }
@@ -61,8 +85,9 @@ static int writeString(displayPort_t *displayPort, uint8_t x, uint8_t y,
 static int writeChar(displayPort_t *displayPort, uint8_t x, uint8_t y,
                      uint8_t c) {
     UNUSED(displayPort);
-    if (x < CHARS_PER_LINE && y < VIDEO_LINES) {
+    if (x < canvasColumns && y < canvasRows) {
         osdBackBuffer[y][x] = c;
+        backDirtyRows |= 1u << y;
     }
     return 0;
 }
@@ -78,8 +103,8 @@ static bool isSynced(const displayPort_t *displayPort) {
 }
 
 static void resync(displayPort_t *displayPort) {
-    displayPort->rows = VIDEO_LINES;
-    displayPort->cols = CHARS_PER_LINE;
+    displayPort->rows = canvasRows;
+    displayPort->cols = canvasColumns;
 }
 
 static int heartbeat(displayPort_t *displayPort) {
@@ -118,3 +143,9 @@ displayPort_t *max7456DisplayPortInit(const struct vcdProfile_s *vcdProfile) {
 
     return &fakeDisplayPort;
 }
+
+void fakeDisplaySetCanvas(uint8_t columns, uint8_t rows) {
+    canvasColumns = columns < MAX_CHARS_PER_LINE ? columns : MAX_CHARS_PER_LINE;
+    canvasRows = rows < MAX_VIDEO_LINES ? rows : MAX_VIDEO_LINES;
+    resync(&fakeDisplayPort);
+}
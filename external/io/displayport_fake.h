@@ -2,6 +2,17 @@
 
 #include <stdint.h>
 
+// The default canvas, an analog OSD.
 #define CHARS_PER_LINE 30
 #define VIDEO_LINES 16
-extern uint8_t osdScreen[VIDEO_LINES][CHARS_PER_LINE];
+// The largest canvas, an HD display port.
+#define MAX_CHARS_PER_LINE 60
+#define MAX_VIDEO_LINES 22
+// The canvas is the top left of osdScreen, rows stay MAX_CHARS_PER_LINE apart.
+extern uint8_t osdScreen[MAX_VIDEO_LINES][MAX_CHARS_PER_LINE];
+// One bit per row of osdScreen that changed, the simulator clears the bits
+// of the rows it sent.
+extern uint32_t osdDirtyRows;
+
+// Sets the canvas size, clamped to the largest, before betaflight starts.
+void fakeDisplaySetCanvas(uint8_t columns, uint8_t rows);
@@ -5,6 +5,8 @@ class_name Packets
 #define GEN # This file is generated from KwadSimSITL/Packets.def, do not edit
 GEN
 
+enum Command {SNAPSHOT = 0, RESTORE = 1, OSD_KEYFRAME = 2}
+
 class Packet extends Object:
     var _props = []
     
@@ -33,6 +35,7 @@ class name extends Packet:
 
 #define S(...) Array
 
+#define IntT int
 #define FloatT float
 #define Vec3T Vector3
 #define BoolT bool
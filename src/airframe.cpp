@@ -0,0 +1,43 @@
+#include "airframe.h"
+
+#include <cassert>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979
+#endif
+
+namespace {
+const auto AIR_RHO = 1.225f;
+}  // namespace
+
+Airframe::Airframe(const InitPacket& packet) {
+    kv = packet.motor_kv.value;
+    inv_kv = 1 / kv;
+    inv_R = 1 / packet.motor_R.value;
+    I0 = packet.motor_I0.value;
+    torque_per_amp = 60 / (kv * 2.0f * float(M_PI));
+    volts_per_pwm = packet.quad_vbat.value / 1000.0f;
+
+    const auto max_rpm = packet.prop_max_rpm.value;
+    for (auto i = 0u; i < 3; i++) {
+        thrust_factors[i] = packet.prop_thrust_factors.value[i].value;
+    }
+    a = packet.prop_a_factor.value;
+    a_max_rpm2 = a * max_rpm * max_rpm;
+    inv_max_rpm = 1 / max_rpm;
+    torque_factor = packet.prop_torque_factor.value;
+    rpm_per_torque = 60.0f / (2.0f * float(M_PI) * packet.prop_inertia.value);
+
+    motor_count = unsigned(packet.motor_count.value);
+    assert(motor_count >= 1 && motor_count <= MaxMotors &&
+           "Unsupported motor count");
+    for (auto i = 0u; i < motor_count; i++) {
+        motor_dir[i] = packet.motor_dir.value[i].value;
+    }
+    mass = packet.quad_mass.value;
+    inv_mass = 1 / mass;
+    gravity = -9.81f * mass;
+    drag = 0.5f * AIR_RHO * packet.frame_drag_constant.value;
+    drag_area = packet.frame_drag_area.value;
+    inv_inertia = packet.quad_inv_inertia.value;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "packets.h"
+#include "vector_math.h"
+
+#include <algorithm>
+#include <cmath>
+
+/// The motor, prop and frame model of an InitPacket, compiled once when the
+/// game connects. Everything the physics derives from the packet is
+/// precomputed, so the per tick functions below are a few multiply-adds
+/// without divisions or branches.
+struct alignas(64) Airframe {
+    // motor:
+    float inv_kv = 0;
+    float inv_R = 0;
+    float I0 = 0;
+    /// 60 / (kv * 2 pi), from Amps to Nm.
+    float torque_per_amp = 0;
+    /// vbat / 1000, from the betaflight motor output to Volts.
+    float volts_per_pwm = 0;
+    float kv = 0;
+
+    // prop, the thrust is a * rpm^2 + b * rpm with
+    // b = (thrust_factors(vel) - a * max_rpm^2) / max_rpm:
+    float thrust_factors[3] = {0, 0, 0};
+    float a = 0;
+    float a_max_rpm2 = 0;
+    float inv_max_rpm = 0;
+    float torque_factor = 0;
+    /// 60 / (2 pi * prop inertia), from Nm to rpm per second.
+    float rpm_per_torque = 0;
+
+    // frame:
+    unsigned motor_count = 0;
+    /// Spin direction, the sign of the motor torque around the up axis.
+    float motor_dir[MaxMotors] = {};
+    float mass = 0;
+    float inv_mass = 0;
+    float gravity = 0;
+    /// 0.5 * air density * drag constant.
+    float drag = 0;
+    vmath::vec3 drag_area = {0, 0, 0};
+    vmath::vec3 inv_inertia = {0, 0, 0};
+
+    Airframe() = default;
+    explicit Airframe(const InitPacket& packet);
+
+    float motor_volts(int16_t pwm) const {
+        return pwm * volts_per_pwm;
+    }
+
+    float motor_torque(float volts, float rpm) const {
+        const auto current = (volts - rpm * inv_kv) * inv_R;
+        // The no load current works against the direction of the current.
+        const auto loaded = std::max(0.0f, std::fabs(current) - I0);
+        return std::copysign(loaded, current) * torque_per_amp;
+    }
+
+    float prop_thrust(float rpm, float vel) const {
+        // max thrust vs velocity:
+        const auto propF = std::max(
+          0.0f,
+          (thrust_factors[0] * vel + thrust_factors[1]) * vel +
+            thrust_factors[2]);
+
+        // thrust vs rpm (and max thrust)
+        const auto b = (propF - a_max_rpm2) * inv_max_rpm;
+        return std::max(0.0f, (b + a * rpm) * rpm);
+    }
+
+    /// Change of the motor speed in rpm per second.
+    float rpm_rate(float torque, float rpm, float vel) const {
+        const auto ptorque = prop_thrust(rpm, vel) * torque_factor;
+        return (torque - ptorque) * rpm_per_torque;
+    }
+};
@@ -0,0 +1,276 @@
+#include "batch_physics.h"
+
+#include <cassert>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979
+#endif
+
+namespace {
+const auto AIR_RHO = 1.225f;
+}  // namespace
+
+using simd::broadcast;
+using simd::vfloat;
+
+BatchPhysics::BatchPhysics(const InitPacket& init_packet, std::size_t count)
+    : count(count), blocks((count + simd::width - 1) / simd::width) {
+    assert(init_packet.motor_count.value == 4 && "Only quads are batched");
+
+    motor_kv = broadcast(init_packet.motor_kv.value);
+    motor_R = broadcast(init_packet.motor_R.value);
+    motor_I0 = broadcast(init_packet.motor_I0.value);
+    vbat = broadcast(init_packet.quad_vbat.value);
+
+    prop_max_rpm = broadcast(init_packet.prop_max_rpm.value);
+    prop_a_factor = broadcast(init_packet.prop_a_factor.value);
+    prop_torque_factor = broadcast(init_packet.prop_torque_factor.value);
+    prop_inertia = broadcast(init_packet.prop_inertia.value);
+
+    frame_drag_constant = broadcast(init_packet.frame_drag_constant.value);
+    mass = broadcast(init_packet.quad_mass.value);
+
+    for (auto j = 0u; j < 3; j++) {
+        prop_thrust_factors[j] =
+          broadcast(init_packet.prop_thrust_factors.value[j].value);
+        frame_drag_area[j] = broadcast(init_packet.frame_drag_area.value[j]);
+        inv_inertia[j] = broadcast(init_packet.quad_inv_inertia.value[j]);
+        for (auto i = 0u; i < 4; i++) {
+            motor_pos[i][j] =
+              broadcast(init_packet.quad_motor_pos.value[i].value[j]);
+        }
+    }
+    for (auto i = 0u; i < 4; i++) {
+        motor_dir[i] = broadcast(init_packet.motor_dir.value[i].value);
+    }
+
+    const auto zero = broadcast(0);
+    for (auto& b : blocks) {
+        for (auto j = 0u; j < 3; j++) {
+            for (auto k = 0u; k < 3; k++) {
+                b.rotation[j][k] = broadcast(j == k ? 1 : 0);
+            }
+            b.angularVelocity[j] = zero;
+            b.linearVelocity[j] = zero;
+            b.acceleration[j] = zero;
+        }
+        for (auto i = 0u; i < 4; i++) {
+            b.rpm[i] = zero;
+            b.thrust[i] = zero;
+            b.pwm[i] = zero;
+        }
+    }
+}
+
+BatchPhysics::Block& BatchPhysics::block(std::size_t i) {
+    return blocks[i / simd::width];
+}
+
+const BatchPhysics::Block& BatchPhysics::block(std::size_t i) const {
+    return blocks[i / simd::width];
+}
+
+std::size_t BatchPhysics::size() const {
+    return count;
+}
+
+void BatchPhysics::set_state(std::size_t i, const StatePacket& state) {
+    auto& b = block(i);
+    const int lane = i % simd::width;
+    for (auto j = 0u; j < 3; j++) {
+        for (auto k = 0u; k < 3; k++) {
+            simd::set(b.rotation[j][k], lane, state.rotation.value[j][k]);
+        }
+        simd::set(b.angularVelocity[j], lane, state.angularVelocity.value[j]);
+        simd::set(b.linearVelocity[j], lane, state.linearVelocity.value[j]);
+    }
+}
+
+void BatchPhysics::set_motors(std::size_t i, const std::array<float, 4>& pwm) {
+    auto& b = block(i);
+    const int lane = i % simd::width;
+    for (auto m = 0u; m < 4; m++) {
+        simd::set(b.pwm[m], lane, pwm[m]);
+    }
+}
+
+vmath::mat3 BatchPhysics::rotation(std::size_t i) const {
+    const auto& b = block(i);
+    const int lane = i % simd::width;
+    vmath::mat3 result;
+    for (auto j = 0u; j < 3; j++) {
+        for (auto k = 0u; k < 3; k++) {
+            result[j][k] = simd::get(b.rotation[j][k], lane);
+        }
+    }
+    return result;
+}
+
+vmath::vec3 BatchPhysics::angular_velocity(std::size_t i) const {
+    const auto& b = block(i);
+    const int lane = i % simd::width;
+    return {simd::get(b.angularVelocity[0], lane),
+            simd::get(b.angularVelocity[1], lane),
+            simd::get(b.angularVelocity[2], lane)};
+}
+
+vmath::vec3 BatchPhysics::linear_velocity(std::size_t i) const {
+    const auto& b = block(i);
+    const int lane = i % simd::width;
+    return {simd::get(b.linearVelocity[0], lane),
+            simd::get(b.linearVelocity[1], lane),
+            simd::get(b.linearVelocity[2], lane)};
+}
+
+vmath::vec3 BatchPhysics::acceleration(std::size_t i) const {
+    const auto& b = block(i);
+    const int lane = i % simd::width;
+    return {simd::get(b.acceleration[0], lane),
+            simd::get(b.acceleration[1], lane),
+            simd::get(b.acceleration[2], lane)};
+}
+
+float BatchPhysics::rpm(std::size_t i, std::size_t motor) const {
+    return simd::get(block(i).rpm[motor], i % simd::width);
+}
+
+void BatchPhysics::step(float dt) {
+    const auto zero = broadcast(0);
+    const auto vdt = broadcast(dt);
+    const auto rpm_per_rad = broadcast(60.0f / (2.0f * float(M_PI)));
+    const auto torque_per_amp =
+      broadcast(60) / (motor_kv * broadcast(2.0f * float(M_PI)));
+    const auto max_rpm2 = prop_a_factor * prop_max_rpm * prop_max_rpm;
+
+    for (auto& b : blocks) {
+        // motors:
+        const vfloat up[3] = {
+          b.rotation[0][1], b.rotation[1][1], b.rotation[2][1]};
+        const auto vel =
+          simd::max(zero,
+                    b.linearVelocity[0] * up[0] + b.linearVelocity[1] * up[1] +
+                      b.linearVelocity[2] * up[2]);
+
+        // max thrust vs velocity:
+        const auto propF = simd::max(
+          zero,
+          prop_thrust_factors[0] * vel * vel + prop_thrust_factors[1] * vel +
+            prop_thrust_factors[2]);
+        const auto prop_b = (propF - max_rpm2) / prop_max_rpm;
+
+        auto motorsTorque = zero;
+        for (auto i = 0u; i < 4; i++) {
+            auto rpm = b.rpm[i];
+
+            const auto volts = b.pwm[i] / broadcast(1000.0f) * vbat;
+
+            auto current = (volts - rpm / motor_kv) / motor_R;
+            current = simd::select(
+              current > zero,
+              simd::max(zero, current - motor_I0),
+              simd::select(
+                current < zero, simd::min(zero, current + motor_I0), current));
+            const auto torque = current * torque_per_amp;
+
+            const auto ptorque =
+              simd::max(prop_b * rpm + prop_a_factor * rpm * rpm, zero) *
+              prop_torque_factor;
+            const auto domega = (torque - ptorque) / prop_inertia;
+            const auto drpm = domega * vdt * rpm_per_rad;
+
+            const auto maxdrpm = simd::abs(volts * motor_kv - rpm);
+            rpm += simd::clamp(drpm, -maxdrpm, maxdrpm);
+
+            b.thrust[i] =
+              simd::max(prop_b * rpm + prop_a_factor * rpm * rpm, zero);
+            b.rpm[i] = rpm;
+            motorsTorque += motor_dir[i] * torque;
+        }
+
+        // drag:
+        const auto vel2 = b.linearVelocity[0] * b.linearVelocity[0] +
+                          b.linearVelocity[1] * b.linearVelocity[1] +
+                          b.linearVelocity[2] * b.linearVelocity[2];
+        const auto speed = simd::sqrt(vel2);
+        const auto is_still = speed == zero;
+
+        vfloat dir[3];
+        for (auto j = 0u; j < 3; j++) {
+            dir[j] = simd::select(is_still, zero, b.linearVelocity[j] / speed);
+        }
+
+        auto area = zero;
+        for (auto j = 0u; j < 3; j++) {
+            const auto local_dir = b.rotation[0][j] * dir[0] +
+                                   b.rotation[1][j] * dir[1] +
+                                   b.rotation[2][j] * dir[2];
+            area += frame_drag_area[j] * simd::abs(local_dir);
+        }
+        const auto drag =
+          broadcast(0.5f * AIR_RHO) * vel2 * frame_drag_constant * area;
+
+        // force sum:
+        auto total_thrust = zero;
+        for (auto i = 0u; i < 4; i++) {
+            total_thrust += b.thrust[i];
+        }
+
+        vfloat total_force[3];
+        for (auto j = 0u; j < 3; j++) {
+            total_force[j] = up[j] * total_thrust - dir[j] * drag;
+        }
+        total_force[1] = total_force[1] - broadcast(9.81f) * mass;
+
+        for (auto j = 0u; j < 3; j++) {
+            b.acceleration[j] = total_force[j] / mass;
+            b.linearVelocity[j] += b.acceleration[j] * vdt;
+        }
+
+        // moment sum around origin:
+        vfloat moment[3];
+        for (auto j = 0u; j < 3; j++) {
+            moment[j] = up[j] * motorsTorque;
+        }
+
+        for (auto i = 0u; i < 4; i++) {
+            vfloat rad[3];
+            for (auto j = 0u; j < 3; j++) {
+                rad[j] = b.rotation[j][0] * motor_pos[i][0] +
+                         b.rotation[j][1] * motor_pos[i][1] +
+                         b.rotation[j][2] * motor_pos[i][2];
+            }
+            const vfloat force[3] = {
+              up[0] * b.thrust[i], up[1] * b.thrust[i], up[2] * b.thrust[i]};
+            moment[0] += rad[1] * force[2] - rad[2] * force[1];
+            moment[1] += rad[2] * force[0] - rad[0] * force[2];
+            moment[2] += rad[0] * force[1] - rad[1] * force[0];
+        }
+
+        // R * inv_inertia * R^T * moment:
+        vfloat local_acc[3];
+        for (auto j = 0u; j < 3; j++) {
+            local_acc[j] = inv_inertia[j] * (b.rotation[0][j] * moment[0] +
+                                             b.rotation[1][j] * moment[1] +
+                                             b.rotation[2][j] * moment[2]);
+        }
+        for (auto j = 0u; j < 3; j++) {
+            const auto angular_acc = b.rotation[j][0] * local_acc[0] +
+                                     b.rotation[j][1] * local_acc[1] +
+                                     b.rotation[j][2] * local_acc[2];
+            b.angularVelocity[j] += angular_acc * vdt;
+        }
+
+        // rotation = W * rotation:
+        const vfloat w[3] = {b.angularVelocity[0] * vdt,
+                             b.angularVelocity[1] * vdt,
+                             b.angularVelocity[2] * vdt};
+        for (auto k = 0u; k < 3; k++) {
+            const auto r0 = b.rotation[0][k];
+            const auto r1 = b.rotation[1][k];
+            const auto r2 = b.rotation[2][k];
+            b.rotation[0][k] = r0 - w[2] * r1 + w[1] * r2;
+            b.rotation[1][k] = w[2] * r0 + r1 - w[0] * r2;
+            b.rotation[2][k] = r2 - w[1] * r0 + w[0] * r1;
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "packets.h"
+#include "simd.h"
+#include "vector_math.h"
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+/// Advances many quads with the same airframe at once. The state is
+/// stored in blocks of simd::width vehicles with one vehicle per lane, so
+/// every operation of the motor and physics model runs on a whole block.
+class BatchPhysics {
+   public:
+    using vfloat = simd::vfloat;
+
+    struct Block {
+        vfloat rotation[3][3];
+        vfloat angularVelocity[3];
+        vfloat linearVelocity[3];
+        vfloat acceleration[3];
+
+        vfloat rpm[4];
+        vfloat thrust[4];
+
+        /// Motor outputs as written by betaflight, 0 - 1000.
+        vfloat pwm[4];
+    };
+
+   private:
+    std::size_t count;
+    std::vector<Block> blocks;
+
+    vfloat motor_kv;
+    vfloat motor_R;
+    vfloat motor_I0;
+    vfloat vbat;
+
+    vfloat prop_max_rpm;
+    vfloat prop_a_factor;
+    vfloat prop_torque_factor;
+    vfloat prop_inertia;
+    vfloat prop_thrust_factors[3];
+
+    vfloat frame_drag_area[3];
+    vfloat frame_drag_constant;
+
+    vfloat mass;
+    vfloat inv_inertia[3];
+    vfloat motor_pos[4][3];
+    vfloat motor_dir[4];
+
+    Block& block(std::size_t i);
+    const Block& block(std::size_t i) const;
+
+   public:
+    BatchPhysics(const InitPacket& init_packet, std::size_t count);
+
+    std::size_t size() const;
+
+    void set_state(std::size_t i, const StatePacket& state);
+    void set_motors(std::size_t i, const std::array<float, 4>& pwm);
+
+    vmath::mat3 rotation(std::size_t i) const;
+    vmath::vec3 angular_velocity(std::size_t i) const;
+    vmath::vec3 linear_velocity(std::size_t i) const;
+    vmath::vec3 acceleration(std::size_t i) const;
+    float rpm(std::size_t i, std::size_t motor) const;
+
+    /// Same model as Simulator::calculate_motors followed by
+    /// Simulator::calculate_physics, for all vehicles.
+    void step(float dt);
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/// Counts durations in logarithmic buckets, 4 per power of two, so recording
+/// is a few instructions and the percentiles are within 25%.
+class Histogram {
+    static constexpr uint32_t SubBits = 2;
+    static constexpr uint32_t SubBuckets = 1 << SubBits;
+
+    std::array<uint64_t, 64 * SubBuckets> buckets{};
+    uint64_t total = 0;
+    uint64_t maximum = 0;
+
+    static std::size_t bucket(uint64_t value) {
+        if (value < SubBuckets) {
+            return std::size_t(value);
+        }
+        const auto log = 63u - uint32_t(__builtin_clzll(value));
+        const auto sub = (value >> (log - SubBits)) & (SubBuckets - 1);
+        return (log - SubBits + 1) * SubBuckets + sub;
+    }
+
+    /// Largest value that falls into bucket i.
+    static uint64_t upper_bound(std::size_t i) {
+        if (i < SubBuckets) {
+            return i;
+        }
+        const auto log = uint32_t(i / SubBuckets) + SubBits - 1;
+        const auto sub = uint64_t(i % SubBuckets);
+        return ((SubBuckets + sub + 1) << (log - SubBits)) - 1;
+    }
+
+   public:
+    void record(uint64_t value) {
+        buckets[bucket(value)]++;
+        total++;
+        maximum = std::max(maximum, value);
+    }
+
+    void clear() {
+        buckets.fill(0);
+        total = 0;
+        maximum = 0;
+    }
+
+    uint64_t count() const {
+        return total;
+    }
+
+    uint64_t max() const {
+        return maximum;
+    }
+
+    /// Upper bound of the bucket that holds the p-th fraction of the values,
+    /// e.g. percentile(0.99).
+    uint64_t percentile(double p) const {
+        const auto rank = uint64_t(p * double(total));
+        uint64_t seen = 0;
+        for (auto i = 0u; i < buckets.size(); i++) {
+            seen += buckets[i];
+            if (seen > rank) {
+                return std::min(upper_bound(i), maximum);
+            }
+        }
+        return maximum;
+    }
+};
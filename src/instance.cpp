@@ -0,0 +1,29 @@
+#include "simulator.h"
+
+#include <fmt/format.h>
+
+#include <atomic>
+
+/// Entry point of the kwadSimInstance module. Every copy of the module that
+/// is loaded into its own link namespace gets its own betaflight globals, so
+/// kwadSimMulti can run one of these per thread. The simulated time is
+/// published to micros after every step for the thread that started it.
+extern "C" int kwadsim_run(uint16_t recv_port,
+                           uint16_t send_port,
+                           uint16_t serial_port,
+                           std::atomic<uint64_t>* micros) {
+    Simulator simulator(recv_port, send_port, serial_port);
+
+    if (!simulator.connect()) {
+        fmt::print("Failed to receive init packet on port {}\n", recv_port);
+        return 1;
+    }
+
+    while (simulator.step()) {
+        micros->store(simulator.micros_passed, std::memory_order_relaxed);
+    }
+
+    fmt::print("Stopped betaflight instance on port {}\n", recv_port);
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "kwadsim.h"
+
+#include "simulator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+
+struct sim {
+    Simulator simulator;
+
+    explicit sim(uint16_t serial_port)
+        : simulator(std::make_unique<NullTransport>(), serial_port) {
+        // The host steps as fast as it can, only poll the serial ports.
+        simulator.serial_timeout = 0;
+    }
+};
+
+static_assert(KWADSIM_MAX_MOTORS == MaxMotors);
+static_assert(KWADSIM_OSD_SIZE == OsdSize);
+
+namespace {
+bool created = false;
+
+void copy(vmath::vec3& to, const float (&from)[3]) {
+    for (auto i = 0u; i < 3; i++) {
+        to[i] = from[i];
+    }
+}
+
+void copy(float (&to)[3], const vmath::vec3& from) {
+    for (auto i = 0u; i < 3; i++) {
+        to[i] = from[i];
+    }
+}
+}  // namespace
+
+uint32_t sim_api_version(void) {
+    return KWADSIM_API_VERSION;
+}
+
+sim_t* sim_create(uint16_t serial_port) {
+    // betaflight can't be initialized twice, so this also covers a
+    // simulator that was already destroyed
+    if (created) {
+        return nullptr;
+    }
+
+    created = true;
+    return new sim(serial_port);
+}
+
+bool sim_init(sim_t* sim, const sim_airframe_t* airframe) {
+    assert(sim && airframe);
+
+    InitPacket packet;
+    packet.motor_kv = airframe->motor_kv;
+    packet.motor_R = airframe->motor_R;
+    packet.motor_I0 = airframe->motor_I0;
+
+    packet.prop_max_rpm = airframe->prop_max_rpm;
+    packet.prop_a_factor = airframe->prop_a_factor;
+    packet.prop_torque_factor = airframe->prop_torque_factor;
+    packet.prop_inertia = airframe->prop_inertia;
+    for (auto i = 0u; i < 3; i++) {
+        packet.prop_thrust_factors.value[i] = airframe->prop_thrust_factors[i];
+    }
+
+    copy(packet.frame_drag_area.value, airframe->frame_drag_area);
+    packet.frame_drag_constant = airframe->frame_drag_constant;
+
+    packet.quad_mass = airframe->quad_mass;
+    copy(packet.quad_inv_inertia.value, airframe->quad_inv_inertia);
+    packet.quad_vbat = airframe->quad_vbat;
+    packet.motor_count = airframe->motor_count;
+    for (auto i = 0u; i < MaxMotors; i++) {
+        copy(packet.quad_motor_pos.value[i].value, airframe->quad_motor_pos[i]);
+        packet.motor_dir.value[i] = airframe->motor_dir[i];
+    }
+
+    return sim->simulator.init(packet);
+}
+
+void sim_step(sim_t* sim, sim_state_t* state, sim_update_t* update) {
+    assert(sim && state);
+
+    StatePacket packet;
+    packet.delta = state->delta;
+    copy(packet.position.value, state->position);
+    for (auto i = 0u; i < 3; i++) {
+        copy(packet.rotation.value[i], state->rotation[i]);
+    }
+    copy(packet.angularVelocity.value, state->angular_velocity);
+    copy(packet.linearVelocity.value, state->linear_velocity);
+    for (auto i = 0u; i < 8; i++) {
+        packet.rcData.value[i] = state->rc_data[i];
+    }
+    packet.crashed = state->crashed;
+
+    sim->simulator.advance(packet);
+
+    for (auto i = 0u; i < 3; i++) {
+        copy(state->rotation[i], packet.rotation.value[i]);
+    }
+    copy(state->angular_velocity, packet.angularVelocity.value);
+    copy(state->linear_velocity, packet.linearVelocity.value);
+
+    if (update) {
+        update->osd_updated = sim->simulator.update_osd(update->osd);
+    }
+}
+
+bool sim_snapshot(sim_t* sim) {
+    assert(sim);
+    return sim->simulator.snapshot();
+}
+
+bool sim_restore(sim_t* sim) {
+    assert(sim);
+    return sim->simulator.restore();
+}
+
+bool sim_set_rates(sim_t* sim,
+                   uint32_t scheduler_hz,
+                   uint32_t physics_hz,
+                   uint32_t sensor_hz) {
+    assert(sim);
+    const auto skip_idle = sim->simulator.get_rates().skip_idle;
+    return sim->simulator.set_rates(
+      {scheduler_hz, physics_hz, sensor_hz, skip_idle});
+}
+
+void sim_set_skip_idle(sim_t* sim, bool skip_idle) {
+    assert(sim);
+    auto rates = sim->simulator.get_rates();
+    rates.skip_idle = skip_idle;
+    sim->simulator.set_rates(rates);
+}
+
+uint64_t sim_micros(const sim_t* sim) {
+    assert(sim);
+    return sim->simulator.micros_passed;
+}
+
+void sim_destroy(sim_t* sim) {
+    delete sim;
+}
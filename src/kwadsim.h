@@ -0,0 +1,110 @@
+#pragma once
+
+/// C interface of libkwadsim, for hosts that drive the simulator in-process
+/// instead of over UDP. The structs only use fixed size types, so the ABI
+/// stays the same across compilers. Betaflight keeps its state in globals,
+/// so there can only be one simulator per loaded copy of the library.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define KWADSIM_API_VERSION 3
+
+#if defined(_WIN32)
+#define KWADSIM_EXPORT __declspec(dllexport)
+#else
+#define KWADSIM_EXPORT __attribute__((visibility("default")))
+#endif
+
+typedef struct sim sim_t;
+
+#define KWADSIM_MAX_MOTORS 8
+
+/// Same fields as the InitPacket.
+typedef struct {
+    float motor_kv;
+    float motor_R;
+    float motor_I0;
+
+    float prop_max_rpm;
+    float prop_a_factor;
+    float prop_torque_factor;
+    float prop_inertia;
+    float prop_thrust_factors[3];
+
+    float frame_drag_area[3];
+    float frame_drag_constant;
+
+    float quad_mass;
+    float quad_inv_inertia[3];
+    float quad_vbat;
+    /// 1 - KWADSIM_MAX_MOTORS, only that many motors are read.
+    int32_t motor_count;
+    float quad_motor_pos[KWADSIM_MAX_MOTORS][3];
+    float motor_dir[KWADSIM_MAX_MOTORS];
+} sim_airframe_t;
+
+/// Same fields as the StatePacket, rotation is row major.
+typedef struct {
+    float delta;
+    float position[3];
+    float rotation[3][3];
+
+    float angular_velocity[3];
+    float linear_velocity[3];
+    float rc_data[8];
+    bool crashed;
+} sim_state_t;
+
+#define KWADSIM_OSD_SIZE (16 * 30)
+
+/// osd is only written if osd_updated is true.
+typedef struct {
+    bool osd_updated;
+    uint8_t osd[KWADSIM_OSD_SIZE];
+} sim_update_t;
+
+KWADSIM_EXPORT uint32_t sim_api_version(void);
+
+/// Returns NULL if a simulator already exists.
+KWADSIM_EXPORT sim_t* sim_create(uint16_t serial_port);
+
+/// Initializes betaflight, must be called once before sim_step. Returns
+/// false if motor_count is not 1 - KWADSIM_MAX_MOTORS, since version 3.
+KWADSIM_EXPORT bool sim_init(sim_t* sim, const sim_airframe_t* airframe);
+
+/// Advances the simulation by state->delta seconds and writes the new
+/// rotation and velocities back into state. update may be NULL. The serial
+/// ports are polled without waiting for traffic.
+KWADSIM_EXPORT void sim_step(sim_t* sim,
+                             sim_state_t* state,
+                             sim_update_t* update);
+
+KWADSIM_EXPORT bool sim_snapshot(sim_t* sim);
+
+KWADSIM_EXPORT bool sim_restore(sim_t* sim);
+
+/// Sets the betaflight scheduler, physics and sensor rates in Hz, see
+/// Simulator::Rates. Returns false if the rates are not integer ratios of
+/// the scheduler rate. Since version 2.
+KWADSIM_EXPORT bool sim_set_rates(sim_t* sim,
+                                  uint32_t scheduler_hz,
+                                  uint32_t physics_hz,
+                                  uint32_t sensor_hz);
+
+/// Only calls the betaflight scheduler on ticks where a task is due.
+/// Since version 3.
+KWADSIM_EXPORT void sim_set_skip_idle(sim_t* sim, bool skip_idle);
+
+/// Simulated time since sim_init.
+KWADSIM_EXPORT uint64_t sim_micros(const sim_t* sim);
+
+KWADSIM_EXPORT void sim_destroy(sim_t* sim);
+
+#ifdef __cplusplus
+}
+#endif
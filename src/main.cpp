@@ -1,10 +1,19 @@
 #include "packets.h"
 
+#include "mmsg_transport.h"
+#include "realtime.h"
+#include "shm_transport.h"
 #include "simulator.h"
 
 #include <fmt/format.h>
 
+#include <algorithm>
 #include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 
 using hr_clock = std::chrono::high_resolution_clock;
 
@@ -18,16 +27,196 @@ auto to_ms(std::chrono::duration<R, P> t) {
     return std::chrono::duration_cast<std::chrono::milliseconds>(t).count();
 }
 
+// Set by SIGUSR1 to print the step profile without stopping.
+static volatile std::sig_atomic_t print_profile = 0;
+
 void clearline() {
     fmt::print(
       "\r                                                                    "
       "                          \r");
 }
 
-int main() {
-    auto& simulator = Simulator::getInstance();
+int main(int argc, char** argv) {
+    const char* record_path = nullptr;
+    bool use_shm = false;
+    bool use_mmsg = false;
+    bool futex = true;
+    std::chrono::microseconds busy_poll{0};
+    RealtimeOptions realtime;
+    bool profile = false;
+    auto integrator = Simulator::Integrator::SemiImplicit;
+    Simulator::Rates rates;
+    SensorPipeline sensors;
+    GyroNoise::Options noise;
+    bool osd_deltas = false;
+    uint32_t osd_columns = OsdColumns;
+    uint32_t osd_rows = OsdRows;
+    const char* task_csv_path = nullptr;
+
+    for (auto i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--shm") == 0) {
+            use_shm = true;
+        } else if (std::strcmp(argv[i], "--spin") == 0) {
+            futex = false;
+        } else if (std::strcmp(argv[i], "--mmsg") == 0) {
+            use_mmsg = true;
+        } else if (std::strcmp(argv[i], "--busy-poll") == 0 && i + 1 < argc) {
+            use_mmsg = true;
+            busy_poll = std::chrono::microseconds(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            realtime.cpu = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--fifo") == 0 && i + 1 < argc) {
+            realtime.fifo_priority = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--rates") == 0 && i + 1 < argc) {
+            if (std::sscanf(argv[++i],
+                            "%u:%u:%u",
+                            &rates.scheduler_hz,
+                            &rates.physics_hz,
+                            &rates.sensor_hz) != 3) {
+                fmt::print("--rates takes scheduler:physics:sensor in Hz\n");
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--sensor") == 0 && i + 1 < argc) {
+            char name[8] = "";
+            SensorPipeline::Timing timing;
+            const auto fields = std::sscanf(argv[++i],
+                                            "%7[a-z]:%u:%u",
+                                            name,
+                                            &timing.rate_hz,
+                                            &timing.latency_us);
+            auto sensor = SensorPipeline::SensorCount;
+            for (auto j = 0u; j < SensorPipeline::SensorCount; j++) {
+                const auto s = SensorPipeline::Sensor(j);
+                if (std::strcmp(name, SensorPipeline::name(s)) == 0) sensor = s;
+            }
+            if (fields < 2 || sensor == SensorPipeline::SensorCount ||
+                !sensors.set_timing(sensor, timing)) {
+                fmt::print("--sensor takes gyro|acc|baro|mag|gps:hz[:latency "
+                           "us], the latency can be at most {} "
+                           "samples\n",
+                           SensorPipeline::MaxInFlight - 2);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--gyro-noise") == 0 && i + 1 < argc) {
+            if (std::sscanf(argv[++i],
+                            "%f:%f:%u",
+                            &noise.noise_dps,
+                            &noise.vibration_dps,
+                            &noise.harmonics) < 1) {
+                fmt::print("--gyro-noise takes rms[:vibration[:harmonics]] in "
+                           "deg/s\n");
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--osd-delta") == 0) {
+            osd_deltas = true;
+        } else if (std::strcmp(argv[i], "--osd-canvas") == 0 && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%ux%u", &osd_columns, &osd_rows) != 2) {
+                fmt::print("--osd-canvas takes columnsxrows, e.g. 53x20\n");
+                return 1;
+            }
+            osd_deltas = true;
+        } else if (std::strcmp(argv[i], "--skip-idle") == 0) {
+            rates.skip_idle = true;
+        } else if (std::strcmp(argv[i], "--rk4") == 0) {
+            integrator = Simulator::Integrator::Rk4;
+        } else if (std::strcmp(argv[i], "--profile") == 0) {
+            profile = true;
+        } else if (std::strcmp(argv[i], "--profile-csv") == 0 && i + 1 < argc) {
+            profile = true;
+            task_csv_path = argv[++i];
+        } else {
+            fmt::print("usage: {} [--record trace.bin]\n"
+                       "    [--shm [--spin] | --mmsg | --busy-poll us]\n"
+                       "    [--cpu n] [--fifo priority]\n"
+                       "    [--rates scheduler:physics:sensor] [--skip-idle]\n"
+                       "    [--sensor name:hz[:latency us]]...\n"
+                       "    [--gyro-noise rms[:vibration[:harmonics]]]\n"
+                       "    [--osd-delta] [--osd-canvas columnsxrows]\n"
+                       "    [--rk4] [--profile [--profile-csv tasks.csv]]\n",
+                       argv[0]);
+            return 1;
+        }
+    }
+
+    // Before betaflight starts, so everything it allocates is locked too.
+    enable_realtime(realtime);
+
+    std::unique_ptr<Transport> transport;
+    const Histogram* wakeup_latency = nullptr;
+    if (use_shm) {
+        auto shm = std::make_unique<ShmTransport>(
+          ShmTransport::DEFAULT_NAME, ShmTransport::Side::Simulator, futex);
+        if (!shm->valid()) {
+            fmt::print("Failed to create {}\n", ShmTransport::DEFAULT_NAME);
+            return 1;
+        }
+        fmt::print("Using shared memory {}\n", ShmTransport::DEFAULT_NAME);
+        transport = std::move(shm);
+    } else if (use_mmsg) {
+        auto mmsg =
+          std::make_unique<MmsgTransport>(Simulator::DEFAULT_RECV_PORT,
+                                          Simulator::DEFAULT_SEND_PORT,
+                                          busy_poll);
+        if (!mmsg->valid()) {
+            fmt::print("Failed to open the batched UDP sockets\n");
+            return 1;
+        }
+        wakeup_latency = &mmsg->wakeup_latency();
+        transport = std::move(mmsg);
+    } else {
+        transport = std::make_unique<UdpTransport>(
+          Simulator::DEFAULT_RECV_PORT, Simulator::DEFAULT_SEND_PORT);
+    }
+
+    if (record_path) {
+        auto recorder = std::make_unique<RecordingTransport>(
+          std::move(transport), record_path);
+        if (!recorder->valid()) {
+            fmt::print("Failed to open {}\n", record_path);
+            return 1;
+        }
+        fmt::print("Recording trace to {}\n", record_path);
+        transport = std::move(recorder);
+    }
+
+    const Transport& link = *transport;
+    Simulator simulator(std::move(transport));
+
+    if (!simulator.set_rates(rates)) {
+        fmt::print("The physics and sensor rates have to divide the "
+                   "scheduler rate, which has to divide 1 MHz\n");
+        return 1;
+    }
+    simulator.physics.integrator = integrator;
+    simulator.sensors = sensors;
+    simulator.noise = noise;
+    simulator.osd_deltas = osd_deltas;
+    // Waiting for serial traffic after every packet would undo the low
+    // wakeup latency.
+    if (realtime.cpu >= 0 || realtime.fifo_priority > 0 ||
+        busy_poll.count() > 0) {
+        simulator.serial_timeout = 0;
+    }
+    if (!simulator.set_osd_canvas(osd_columns, osd_rows)) {
+        fmt::print("The OSD canvas can be at most {}x{}\n",
+                   MaxOsdColumns,
+                   MaxOsdRows);
+        return 1;
+    }
+    simulator.profiler.enable(profile);
+    simulator.task_profiler.enable(profile);
+#ifdef SIGUSR1
+    if (profile) {
+        std::signal(SIGUSR1, [](int) { print_profile = 1; });
+    }
+#endif
 
-    simulator.connect();
+    if (!simulator.connect()) {
+        fmt::print("Failed to receive init packet\n");
+        return 1;
+    }
 
     auto start = hr_clock::now();
     auto i = 0u;
@@ -44,9 +233,51 @@ int main() {
                        delta);
         }
 
+        if (print_profile) {
+            print_profile = 0;
+            fmt::print("\n");
+            simulator.profiler.print(stdout);
+            simulator.task_profiler.print(stdout);
+        }
+
         i++;
     }
 
+    const auto counters = link.counters();
+    const auto frames = std::max<uint64_t>(simulator.frames, 1);
+    fmt::print("\n{} frames, {} packets received, {} sent, {:.2f} syscalls "
+               "per frame\n",
+               simulator.frames,
+               counters.received,
+               counters.sent,
+               double(counters.syscalls) / frames);
+
+    const auto seconds = std::max(simulator.micros_passed / 1e6, 1e-6);
+    fmt::print("{:.0f} scheduler calls per simulated second\n",
+               simulator.scheduler_calls / seconds);
+
+    if (wakeup_latency && wakeup_latency->count() > 0) {
+        fmt::print("wakeup latency: p50 {:.1f} us, p99 {:.1f} us, "
+                   "max {:.1f} us\n",
+                   wakeup_latency->percentile(0.5) / 1000.0,
+                   wakeup_latency->percentile(0.99) / 1000.0,
+                   wakeup_latency->max() / 1000.0);
+    }
+
+    if (profile) {
+        simulator.profiler.print(stdout);
+        simulator.task_profiler.print(stdout);
+    }
+
+    if (task_csv_path) {
+        if (auto* file = std::fopen(task_csv_path, "w")) {
+            simulator.task_profiler.write_csv(file);
+            std::fclose(file);
+        } else {
+            fmt::print("Failed to write {}\n", task_csv_path);
+        }
+    }
+
     fmt::print("Stopped betaflight host process\n");
 
     return 0;
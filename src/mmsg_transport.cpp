@@ -0,0 +1,246 @@
+#include "mmsg_transport.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <type_traits>
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+namespace {
+sockaddr_in localhost(uint16_t port) {
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return address;
+}
+}  // namespace
+
+MmsgTransport::MmsgTransport(uint16_t recv_port,
+                             uint16_t send_port,
+                             std::chrono::microseconds busy_poll)
+    : busy_poll(busy_poll),
+      recv_data(BatchSize * MaxDatagramSize),
+      recv_lengths(BatchSize) {
+    recv_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    send_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (recv_fd < 0 || send_fd < 0) {
+        return;
+    }
+
+    // Kernel receive timestamps for the wakeup latency.
+    const int on = 1;
+    setsockopt(recv_fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+
+    // Lets the kernel poll the device queue as well, where the driver
+    // supports it. Loopback doesn't, there only our own polling helps.
+    if (busy_poll.count() > 0) {
+        const int budget = int(busy_poll.count());
+        setsockopt(recv_fd, SOL_SOCKET, SO_BUSY_POLL, &budget, sizeof(budget));
+    }
+
+    const auto recv_address = localhost(recv_port);
+    const auto send_address = localhost(send_port);
+    if (bind(recv_fd,
+             reinterpret_cast<const sockaddr*>(&recv_address),
+             sizeof(recv_address)) != 0 ||
+        connect(send_fd,
+                reinterpret_cast<const sockaddr*>(&send_address),
+                sizeof(send_address)) != 0) {
+        close(recv_fd);
+        close(send_fd);
+        recv_fd = send_fd = -1;
+    }
+}
+
+MmsgTransport::~MmsgTransport() {
+    if (valid()) {
+        flush();
+    }
+    if (recv_fd >= 0) close(recv_fd);
+    if (send_fd >= 0) close(send_fd);
+}
+
+bool MmsgTransport::valid() const {
+    return recv_fd >= 0 && send_fd >= 0;
+}
+
+int MmsgTransport::receive_batch(int flags) {
+    using Control = std::aligned_storage_t<CMSG_SPACE(sizeof(timespec)),
+                                           alignof(cmsghdr)>;
+
+    std::array<iovec, BatchSize> iovecs;
+    std::array<Control, BatchSize> controls;
+    std::array<mmsghdr, BatchSize> messages{};
+    for (auto i = 0u; i < BatchSize; i++) {
+        iovecs[i] = {&recv_data[i * MaxDatagramSize], MaxDatagramSize};
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_control = &controls[i];
+        messages[i].msg_hdr.msg_controllen = sizeof(Control);
+    }
+
+    int count;
+    do {
+        count = recvmmsg(recv_fd, messages.data(), BatchSize, flags, nullptr);
+        stats.syscalls++;
+    } while (count < 0 && errno == EINTR);
+
+    if (count <= 0) {
+        return count;
+    }
+
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    for (auto i = 0; i < count; i++) {
+        recv_lengths[i] = messages[i].msg_len;
+
+        auto& header = messages[i].msg_hdr;
+        for (auto* cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr;
+             cmsg = CMSG_NXTHDR(&header, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET ||
+                cmsg->cmsg_type != SCM_TIMESTAMPNS) {
+                continue;
+            }
+
+            timespec received;
+            std::memcpy(&received, CMSG_DATA(cmsg), sizeof(received));
+            const auto ns = (now.tv_sec - received.tv_sec) * 1000000000ll +
+                            (now.tv_nsec - received.tv_nsec);
+            latency.record(uint64_t(std::max(ns, 0ll)));
+        }
+    }
+
+    return count;
+}
+
+std::optional<Transport::View> MmsgTransport::recv() {
+    if (recv_next == recv_count) {
+        // The game waits for the updates before it sends anything new.
+        flush();
+
+        auto count = -1;
+        if (busy_poll.count() > 0) {
+            const auto deadline = std::chrono::steady_clock::now() + busy_poll;
+            do {
+                count = receive_batch(MSG_DONTWAIT);
+            } while (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+                     std::chrono::steady_clock::now() < deadline);
+        }
+
+        if (count < 0) {
+            count = receive_batch(MSG_WAITFORONE);
+        }
+
+        assert(count > 0 && "Error recv packet");
+        if (count <= 0) {
+            return std::nullopt;
+        }
+
+        recv_count = std::size_t(count);
+        recv_next = 0;
+        stats.received += recv_count;
+    }
+
+    const auto i = recv_next++;
+    return View{&recv_data[i * MaxDatagramSize], recv_lengths[i]};
+}
+
+void MmsgTransport::send(const std::byte* data, std::size_t len) {
+    std::memcpy(reserve(len), data, len);
+    commit();
+}
+
+std::byte* MmsgTransport::reserve(std::size_t len) {
+    assert(len <= MaxDatagramSize && "Packet too large for a datagram");
+
+    const auto offset = send_data.size();
+    send_data.resize(offset + len);
+    reserved = len;
+    return &send_data[offset];
+}
+
+void MmsgTransport::commit() {
+    send_packets.emplace_back(send_data.size() - reserved, reserved);
+    if (send_packets.size() == BatchSize) {
+        flush();
+    }
+}
+
+void MmsgTransport::flush() {
+    const auto count = send_packets.size();
+    if (count == 0) {
+        return;
+    }
+
+    std::array<iovec, BatchSize> iovecs;
+    std::array<mmsghdr, BatchSize> messages{};
+    for (auto i = 0u; i < count; i++) {
+        const auto [offset, len] = send_packets[i];
+        iovecs[i] = {&send_data[offset], len};
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    auto sent = 0u;
+    while (sent < count) {
+        const auto result =
+          sendmmsg(send_fd, &messages[sent], unsigned(count - sent), 0);
+        stats.syscalls++;
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            assert(false && "Error send");
+            break;
+        }
+        sent += unsigned(result);
+    }
+
+    stats.sent += count;
+    send_packets.clear();
+    send_data.clear();
+}
+#else
+MmsgTransport::MmsgTransport(uint16_t,
+                             uint16_t,
+                             std::chrono::microseconds busy_poll)
+    : busy_poll(busy_poll) {
+}
+
+MmsgTransport::~MmsgTransport() = default;
+
+bool MmsgTransport::valid() const {
+    return false;
+}
+
+std::optional<Transport::View> MmsgTransport::recv() {
+    return std::nullopt;
+}
+
+void MmsgTransport::send(const std::byte*, std::size_t) {
+}
+
+std::byte* MmsgTransport::reserve(std::size_t len) {
+    return Transport::reserve(len);
+}
+
+void MmsgTransport::commit() {
+}
+
+void MmsgTransport::flush() {
+}
+#endif
+
+const Histogram& MmsgTransport::wakeup_latency() const {
+    return latency;
+}
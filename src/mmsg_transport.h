@@ -0,0 +1,61 @@
+#pragma once
+
+#include "histogram.h"
+#include "transport.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/// UDP link that moves packets in batches: recv() drains every pending
+/// datagram with one recvmmsg call and sent packets are queued until the
+/// next recv() would block, then sent with one sendmmsg call. Only
+/// supported on Linux, valid() is false elsewhere.
+class MmsgTransport : public Transport {
+    static constexpr std::size_t BatchSize = 32;
+    static constexpr std::size_t MaxDatagramSize = 65536;
+
+    int recv_fd = -1;
+    int send_fd = -1;
+
+    std::chrono::microseconds busy_poll;
+    Histogram latency;
+
+    std::vector<std::byte> recv_data;
+    std::vector<std::size_t> recv_lengths;
+    std::size_t recv_count = 0;
+    std::size_t recv_next = 0;
+
+    /// Queued packets as offset and length into send_data.
+    std::vector<std::byte> send_data;
+    std::vector<std::pair<std::size_t, std::size_t>> send_packets;
+    std::size_t reserved = 0;
+
+    /// One recvmmsg call, returns its result.
+    int receive_batch(int flags);
+
+   public:
+    /// With a busy_poll budget recv() polls the socket without sleeping for
+    /// that long before it blocks.
+    MmsgTransport(uint16_t recv_port,
+                  uint16_t send_port,
+                  std::chrono::microseconds busy_poll = {});
+    ~MmsgTransport() override;
+
+    MmsgTransport(const MmsgTransport&) = delete;
+    MmsgTransport& operator=(const MmsgTransport&) = delete;
+
+    bool valid() const;
+
+    std::optional<View> recv() override;
+    void send(const std::byte* data, std::size_t len) override;
+    std::byte* reserve(std::size_t len) override;
+    void commit() override;
+    void flush() override;
+
+    /// Time from the kernel receiving a packet until recv() picked it up,
+    /// in nanoseconds.
+    const Histogram& wakeup_latency() const;
+};
@@ -0,0 +1,115 @@
+#include "simulator.h"
+
+#include <fmt/format.h>
+
+#include <dlfcn.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using RunFn = int (*)(uint16_t, uint16_t, uint16_t, std::atomic<uint64_t>*);
+
+/// The UARTs of the last instance still end below the first reply port.
+constexpr int MaxInstances =
+  (Simulator::DEFAULT_SEND_PORT - Simulator::DEFAULT_SERIAL_PORT) / 10;
+
+/// One copy of the simulator module loaded in a fresh link namespace, so it
+/// has its own betaflight globals, sockets and clock.
+class Instance {
+    void* handle = nullptr;
+    RunFn run = nullptr;
+    std::thread thread;
+
+   public:
+    /// The simulated time, the instance thread updates it after every step.
+    std::atomic<uint64_t> micros = 0;
+    std::atomic<bool> done = false;
+
+    explicit Instance(const char* path) {
+        handle = dlmopen(LM_ID_NEWLM, path, RTLD_NOW | RTLD_LOCAL);
+        if (handle == nullptr) {
+            fmt::print("Failed to load {}: {}\n", path, dlerror());
+            return;
+        }
+
+        run = reinterpret_cast<RunFn>(dlsym(handle, "kwadsim_run"));
+    }
+
+    Instance(const Instance&) = delete;
+    Instance& operator=(const Instance&) = delete;
+
+    ~Instance() {
+        if (thread.joinable()) thread.join();
+        if (handle != nullptr) dlclose(handle);
+    }
+
+    bool valid() const {
+        return run != nullptr;
+    }
+
+    void start(uint16_t recv_port, uint16_t send_port, uint16_t serial_port) {
+        thread = std::thread([=]() {
+            run(recv_port, send_port, serial_port, &micros);
+            done = true;
+        });
+    }
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const auto count = argc < 2 ? 0 : std::atoi(argv[1]);
+    if (count < 1 || count > MaxInstances) {
+        fmt::print(
+          "usage: {} count [module]\n"
+          "count is 1 - {}. Instance i listens on {} + i, replies to {} + i\n"
+          "and opens its UARTs on {} + 10 * i. glibc limits the number of\n"
+          "link namespaces, see the glibc.rtld.nns tunable.\n",
+          argv[0],
+          MaxInstances,
+          Simulator::DEFAULT_RECV_PORT,
+          Simulator::DEFAULT_SEND_PORT,
+          Simulator::DEFAULT_SERIAL_PORT);
+        return 1;
+    }
+
+    const char* path = argc > 2 ? argv[2] : KWADSIM_INSTANCE_PATH;
+
+    std::vector<std::unique_ptr<Instance>> instances;
+    for (auto i = 0; i < count; i++) {
+        auto instance = std::make_unique<Instance>(path);
+        if (!instance->valid()) {
+            fmt::print("Failed to create instance {}\n", i);
+            return 1;
+        }
+
+        instance->start(Simulator::DEFAULT_RECV_PORT + i,
+                        Simulator::DEFAULT_SEND_PORT + i,
+                        Simulator::DEFAULT_SERIAL_PORT + 10 * i);
+        instances.push_back(std::move(instance));
+    }
+
+    auto running = true;
+    while (running) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+        running = false;
+        fmt::print("fake ms:");
+        for (const auto& instance : instances) {
+            fmt::print(" {}", instance->micros / 1000);
+            running |= !instance->done;
+        }
+        fmt::print("\n");
+    }
+
+    fmt::print("Stopped all betaflight instances\n");
+
+    return 0;
+}
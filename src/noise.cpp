@@ -0,0 +1,166 @@
+#include "noise.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <random>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979
+#endif
+
+namespace {
+uint32_t xorshift(uint32_t x) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+// sin(2 pi t) for t in [-0.5, 0.5], parabolic with one correction step,
+// the error is below 0.1%.
+simd::vfloat sin_turns(simd::vfloat t) {
+    using namespace simd;
+    const auto y = t * (broadcast(8) - broadcast(16) * abs(t));
+    return y + broadcast(0.225f) * (y * abs(y) - y);
+}
+}  // namespace
+
+void GyroNoise::fill_ring(const Options& options, uint32_t sample_hz) {
+    ring.clear();
+    if (options.noise_dps <= 0) return;
+
+    ring.resize(RingSize);
+    std::mt19937 rng(options.seed);
+    std::normal_distribution<float> normal;
+
+    // Second order Butterworth lowpass.
+    const auto filtered = sample_hz > 0 &&
+                          options.noise_cutoff_hz < 0.5f * float(sample_hz);
+    const auto k = filtered ? std::tan(float(M_PI) * options.noise_cutoff_hz /
+                                       float(sample_hz))
+                            : 0.0f;
+    const auto norm = 1 / (1 + std::sqrt(2.0f) * k + k * k);
+    const auto b0 = k * k * norm;
+    const auto a1 = 2 * (k * k - 1) * norm;
+    const auto a2 = (1 - std::sqrt(2.0f) * k + k * k) * norm;
+
+    std::vector<float> white(RingSize);
+    for (auto axis = 0u; axis < 3; axis++) {
+        for (auto& w : white) w = normal(rng);
+
+        if (!filtered) {
+            for (auto i = 0u; i < RingSize; i++) ring[i][axis] = white[i];
+        } else {
+            // Two laps, so the filter has settled and the end of the ring
+            // continues into its start.
+            float x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+            for (auto lap = 0u; lap < 2; lap++) {
+                for (auto i = 0u; i < RingSize; i++) {
+                    const auto x = white[i];
+                    const auto y = b0 * (x + 2 * x1 + x2) - a1 * y1 - a2 * y2;
+                    x2 = x1;
+                    x1 = x;
+                    y2 = y1;
+                    y1 = y;
+                    ring[i][axis] = y;
+                }
+            }
+        }
+
+        auto sum2 = 0.0;
+        for (const auto& n : ring) sum2 += double(n[axis]) * n[axis];
+        const auto scale =
+          options.noise_dps / float(std::sqrt(sum2 / RingSize));
+        for (auto& n : ring) n[axis] *= scale;
+    }
+}
+
+void GyroNoise::configure(const Options& options,
+                          const InitPacket& packet,
+                          uint32_t sample_hz) {
+    fill_ring(options, sample_hz);
+
+    const auto motors = uint32_t(packet.motor_count.value);
+    assert(motors <= MaxMotors && "Unsupported motor count");
+    const auto harmonics = std::min(options.harmonics, MaxHarmonics);
+    oscillators = options.vibration_dps > 0 ? motors * harmonics : 0;
+    active_blocks = (oscillators + simd::width - 1) / simd::width;
+
+    turns_per_rpm_us.fill(simd::broadcast(0));
+    for (auto& g : gain) g.fill(simd::broadcast(0));
+
+    state = State();
+    state.jump = std::max(options.seed, 1u);
+
+    std::mt19937 rng(options.seed);
+    std::uniform_real_distribution<float> phase(-0.5f, 0.5f);
+
+    const auto max_rpm = packet.prop_max_rpm.value;
+    for (auto i = 0u; i < oscillators; i++) {
+        const auto motor = i / harmonics;
+        const auto n = float(i % harmonics + 1);
+        const auto block = i / simd::width;
+        const auto lane = i % simd::width;
+        motor_of[i] = uint8_t(motor);
+
+        // The frame rocks around the horizontal axis across the arm, the
+        // spin direction adds a little yaw.
+        const auto& pos = packet.quad_motor_pos.value[motor].value;
+        const auto arm = std::sqrt(pos[0] * pos[0] + pos[2] * pos[2]);
+        const vmath::vec3 axis = {arm > 0 ? pos[2] / arm : 0,
+                                  0.25f * packet.motor_dir.value[motor].value,
+                                  arm > 0 ? -pos[0] / arm : 0};
+        const auto amplitude = options.vibration_dps / (n * max_rpm * max_rpm);
+
+        simd::set(turns_per_rpm_us[block], lane, n / 60e6f);
+        for (auto j = 0u; j < 3; j++) {
+            simd::set(gain[j][block], lane, amplitude * axis[j]);
+        }
+        simd::set(state.phase[block], lane, phase(rng));
+    }
+}
+
+vmath::vec3 GyroNoise::sample(uint64_t now_us,
+                              const std::array<float, MaxMotors>& rpm) {
+    vmath::vec3 result = {0, 0, 0};
+
+    if (!ring.empty()) {
+        const auto& n = ring[state.position];
+        result = {n[0], n[1], n[2]};
+        // A lap at a random start, so the noise doesn't repeat every
+        // RingSize samples.
+        if (++state.position == RingSize) {
+            state.jump = xorshift(state.jump);
+            state.position = state.jump % RingSize;
+        }
+    }
+
+    // Long pauses, e.g. the first sample, only need a random phase.
+    const auto dt = float(std::min(now_us - state.last_us, uint64_t(1000000)));
+    state.last_us = now_us;
+    if (oscillators == 0) return result;
+
+    std::array<vfloat, Blocks> lane_rpm{};
+    for (auto i = 0u; i < oscillators; i++) {
+        simd::set(lane_rpm[i / simd::width], i % simd::width, rpm[motor_of[i]]);
+    }
+
+    const auto vdt = simd::broadcast(dt);
+    auto sum = std::array<vfloat, 3>{};
+    for (auto b = 0u; b < active_blocks; b++) {
+        auto& phase = state.phase[b];
+        phase = phase + lane_rpm[b] * turns_per_rpm_us[b] * vdt;
+        phase = phase - simd::round(phase);
+
+        const auto wave = sin_turns(phase) * lane_rpm[b] * lane_rpm[b];
+        for (auto j = 0u; j < 3; j++) sum[j] += wave * gain[j][b];
+    }
+
+    for (auto j = 0u; j < 3; j++) {
+        for (auto lane = 0; lane < simd::width; lane++) {
+            result[j] += simd::get(sum[j], lane);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "packets.h"
+#include "simd.h"
+#include "vector_math.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/// Gyro noise of a real frame: broadband noise read from a ring of noise
+/// that is filtered once when the airframe is set up, plus the vibration
+/// of every motor at its rpm and harmonics. The vibration oscillators are
+/// stored in blocks of simd::width, so a sample is a table read and a few
+/// vector operations however many motors there are.
+class GyroNoise {
+   public:
+    using vfloat = simd::vfloat;
+
+    struct Options {
+        /// RMS of the broadband noise in deg/s, 0 disables it.
+        float noise_dps = 0;
+        /// The broadband noise is lowpass filtered at this frequency.
+        float noise_cutoff_hz = 250;
+        /// Vibration of one motor at max rpm in deg/s, 0 disables it. The
+        /// amplitude goes with rpm^2.
+        float vibration_dps = 0;
+        /// Harmonics of the motor rpm, the n-th has 1/n of the amplitude.
+        uint32_t harmonics = 3;
+        uint32_t seed = 1;
+    };
+
+    static constexpr uint32_t MaxHarmonics = 4;
+    static constexpr uint32_t MaxOscillators = MaxMotors * MaxHarmonics;
+    static constexpr uint32_t Blocks = MaxOscillators / simd::width;
+    /// Samples of the broadband noise, 64 KB.
+    static constexpr uint32_t RingSize = 4096;
+
+    /// Everything that changes per sample, for snapshots.
+    struct State {
+        /// Oscillator phases in turns, kept within [-0.5, 0.5].
+        std::array<vfloat, Blocks> phase{};
+        uint32_t position = 0;
+        /// xorshift state, picks where the ring is read after a lap.
+        uint32_t jump = 1;
+        uint64_t last_us = 0;
+    };
+
+   private:
+    /// x, y, z and padding, so a sample is one aligned 16 byte read.
+    std::vector<std::array<float, 4>> ring;
+
+    uint32_t oscillators = 0;
+    uint32_t active_blocks = 0;
+    std::array<uint8_t, MaxOscillators> motor_of{};
+    // per oscillator, the unused lanes are 0:
+    std::array<vfloat, Blocks> turns_per_rpm_us{};
+    /// Amplitude per rpm^2 on each body axis.
+    std::array<vfloat, Blocks> gain[3]{};
+
+    State state;
+
+    void fill_ring(const Options& options, uint32_t sample_hz);
+
+   public:
+    /// Precomputes the noise ring and the oscillators for the airframe of
+    /// the packet, sampled at sample_hz.
+    void configure(const Options& options,
+                   const InitPacket& packet,
+                   uint32_t sample_hz);
+
+    bool enabled() const {
+        return !ring.empty() || oscillators > 0;
+    }
+
+    /// The noise in deg/s on the body axes at now_us, rpm is per motor.
+    vmath::vec3 sample(uint64_t now_us,
+                       const std::array<float, MaxMotors>& rpm);
+
+    const State& get_state() const {
+        return state;
+    }
+
+    void set_state(const State& state) {
+        this->state = state;
+    }
+};
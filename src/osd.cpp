@@ -0,0 +1,129 @@
+#include "osd.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+constexpr std::size_t RunHeader = 3;
+constexpr uint32_t MaxRun = 255;
+
+uint64_t load_u64(const uint8_t* data) {
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+std::size_t write_run(const uint8_t* screen,
+                      uint32_t start,
+                      uint32_t count,
+                      uint8_t* out) {
+    out[0] = uint8_t(start & 0xFF);
+    out[1] = uint8_t(start >> 8);
+    out[2] = uint8_t(count);
+    std::memcpy(out + RunHeader, screen + start, count);
+    return RunHeader + count;
+}
+}  // namespace
+
+OsdDelta::OsdDelta(uint32_t columns, uint32_t rows)
+    : columns(columns), rows(rows) {
+    assert(columns <= MaxOsdColumns && rows <= MaxOsdRows &&
+           "OSD canvas too large");
+}
+
+void OsdDelta::copy_rows(const uint8_t* screen,
+                         uint32_t stride,
+                         uint32_t mask) {
+    for (auto y = 0u; y < rows; y++) {
+        if (mask & (1u << y)) {
+            std::memcpy(&current[y * columns], screen + y * stride, columns);
+        }
+    }
+}
+
+std::optional<std::size_t> OsdDelta::encode(const uint8_t* screen,
+                                            uint32_t stride,
+                                            uint32_t dirty_rows,
+                                            uint8_t* out) {
+    copy_rows(screen, stride, dirty_rows);
+
+    std::size_t len = 0;
+    // The open run, from start to the last changed cell.
+    uint32_t start = 0;
+    uint32_t last = 0;
+    bool open = false;
+
+    for (auto y = 0u; y < rows; y++) {
+        if (!(dirty_rows & (1u << y))) continue;
+
+        const auto end = (y + 1) * columns;
+        for (auto i = y * columns; i < end; i++) {
+            // Most cells are unchanged, skip them 8 at a time.
+            if (i + 8 <= end && load_u64(&current[i]) == load_u64(&sent[i])) {
+                i += 7;
+                continue;
+            }
+            if (current[i] == sent[i]) continue;
+
+            if (open && i - last <= MaxGap + 1 && i - start < MaxRun) {
+                last = i;
+            } else {
+                if (open) {
+                    len += write_run(
+                      current.data(), start, last - start + 1, out + len);
+                }
+                start = last = i;
+                open = true;
+            }
+
+            // Past this a keyframe is smaller.
+            if (len + RunHeader + last - start + 1 > size()) {
+                return std::nullopt;
+            }
+        }
+    }
+    if (open) {
+        len += write_run(current.data(), start, last - start + 1, out + len);
+    }
+
+    for (auto y = 0u; y < rows; y++) {
+        if (dirty_rows & (1u << y)) {
+            std::memcpy(&sent[y * columns], &current[y * columns], columns);
+        }
+    }
+    return len;
+}
+
+std::size_t OsdDelta::keyframe(const uint8_t* screen,
+                               uint32_t stride,
+                               uint8_t* out) {
+    copy_rows(screen, stride, UINT32_MAX);
+
+    std::size_t len = 0;
+    for (auto start = 0u; start < size(); start += MaxRun) {
+        const auto count = std::min(MaxRun, size() - start);
+        len += write_run(current.data(), start, count, out + len);
+    }
+
+    sent = current;
+    return len;
+}
+
+bool OsdDelta::apply(const uint8_t* runs,
+                     std::size_t len,
+                     uint8_t* canvas,
+                     std::size_t cells) {
+    std::size_t i = 0;
+    while (i + RunHeader <= len) {
+        const auto start = uint32_t(runs[i]) | uint32_t(runs[i + 1]) << 8;
+        const auto count = uint32_t(runs[i + 2]);
+        i += RunHeader;
+        if (start + count > cells || i + count > len) return false;
+
+        std::memcpy(canvas + start, runs + i, count);
+        i += count;
+    }
+    return i == len;
+}
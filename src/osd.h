@@ -0,0 +1,55 @@
+#pragma once
+
+#include "packets.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+/// The OSD canvas as the game last received it, to send only the cells
+/// that changed since. Cells are numbered row by row, y * columns + x, and
+/// encoded as runs: the index of the first cell as 16 bit little endian,
+/// the number of cells as a byte and the cells. Changes a few cells apart
+/// share a run, that is smaller than a new run header.
+class OsdDelta {
+    uint32_t columns = OsdColumns;
+    uint32_t rows = OsdRows;
+    /// The canvas as of the last encode, only its dirty rows are copied.
+    std::array<uint8_t, MaxOsdSize> current{};
+    std::array<uint8_t, MaxOsdSize> sent{};
+
+    void copy_rows(const uint8_t* screen, uint32_t stride, uint32_t mask);
+
+   public:
+    /// Unchanged cells a run may span.
+    static constexpr uint32_t MaxGap = 3;
+
+    OsdDelta() = default;
+    /// Up to MaxOsdColumns x MaxOsdRows.
+    OsdDelta(uint32_t columns, uint32_t rows);
+
+    uint32_t size() const {
+        return columns * rows;
+    }
+
+    /// Writes the runs of the cells in dirty_rows (one bit per row) that
+    /// differ from the last update into out, which has room for
+    /// MaxOsdDeltaSize bytes. The rows of screen are stride bytes apart.
+    /// Returns the length, 0 if nothing changed, or nullopt if so much
+    /// changed that a keyframe is smaller.
+    std::optional<std::size_t> encode(const uint8_t* screen,
+                                      uint32_t stride,
+                                      uint32_t dirty_rows,
+                                      uint8_t* out);
+
+    /// Writes every cell as runs into out, returns the length.
+    std::size_t keyframe(const uint8_t* screen, uint32_t stride, uint8_t* out);
+
+    /// Writes the runs of len bytes into the cells of a canvas, what the
+    /// game does. Returns false if they don't fit the cells.
+    static bool apply(const uint8_t* runs,
+                      std::size_t len,
+                      uint8_t* canvas,
+                      std::size_t cells);
+};
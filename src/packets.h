@@ -6,10 +6,15 @@
 
 #include "vector_math.h"
 
+#include <algorithm>
 #include <array>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <optional>
 #include <tuple>
+#include <type_traits>
+#include <variant>
 
 #include <fmt/format.h>
 #include <kissnet.hpp>
@@ -53,10 +58,23 @@ std::optional<T> parse(std::byte*& data, std::size_t& len) {
     return child;
 }
 
+inline uint32_t load_u32(const std::byte* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+/// Every type has a WireSize, its size on the wire when all numbers are 32
+/// bit, which is what the game sends. _check compares the type ids and
+/// array lengths of such an encoding at their fixed offsets.
 template <uint32_t TypeID>
 struct GodotT {
     uint32_t _typeId = TypeID;
 
+    static bool _check(const std::byte* data) {
+        return load_u32(data) == TypeID;
+    }
+
     bool _parse(std::byte*& data, std::size_t& len) {
         const auto tid = reinterpret_cast<uint32_t*&>(data);
         if (((*tid) & 0xFFFF) != TypeID) {
@@ -68,6 +86,8 @@ struct GodotT {
 };
 
 struct BoolT : public GodotT<1> {
+    static constexpr std::size_t WireSize = 8;
+
     uint32_t value = 0;
 
     BoolT() = default;
@@ -86,7 +106,40 @@ struct BoolT : public GodotT<1> {
     }
 };
 
+struct IntT : GodotT<2> {
+    static constexpr std::size_t WireSize = 8;
+
+    int32_t value = 0;
+
+    IntT() = default;
+    IntT(int32_t val) : value(val) {
+    }
+
+    bool _parse(std::byte*& data, std::size_t& len) {
+        const bool is64 = ((*reinterpret_cast<uint32_t*&>(data)) & 0xFFFF0000);
+        if (!GodotT::_parse(data, len)) return false;
+
+        if (!is64) {
+            memcpy(&value, data, sizeof(int32_t));
+            return advance(data, len, sizeof(int32_t));
+        }
+
+        int64_t tmp;
+        memcpy(&tmp, data, sizeof(int64_t));
+        value = int32_t(tmp);
+        return advance(data, len, sizeof(int64_t));
+    }
+
+    operator int32_t() const {
+        return value;
+    }
+};
+
+static_assert(sizeof(IntT) == 4 + 4);
+
 struct FloatT : GodotT<3> {
+    static constexpr std::size_t WireSize = 8;
+
     float value = 0.0f;
 
     FloatT() = default;
@@ -116,6 +169,8 @@ struct FloatT : GodotT<3> {
 static_assert(sizeof(FloatT) == 4 + 4);
 
 struct Vec3T : public GodotT<7> {
+    static constexpr std::size_t WireSize = 16;
+
     vmath::vec3 value;
 
     Vec3T() = default;
@@ -137,6 +192,8 @@ struct Vec3T : public GodotT<7> {
 static_assert(sizeof(Vec3T) == 16);
 
 struct BasisT : public GodotT<12> {
+    static constexpr std::size_t WireSize = 40;
+
     vmath::mat3 value;
 
     bool _parse(std::byte*& data, std::size_t& len) {
@@ -157,9 +214,19 @@ static_assert(sizeof(BasisT) == 40);
 
 template <typename T, uint32_t Size>
 struct ArrayT : public GodotT<19> {
+    static constexpr std::size_t WireSize = 8 + Size * T::WireSize;
+
     uint32_t _len = Size;
     std::array<T, Size> value;
 
+    static bool _check(const std::byte* data) {
+        bool valid = GodotT::_check(data) & (load_u32(data + 4) == Size);
+        for (auto i = 0u; i < Size; i++) {
+            valid &= T::_check(data + 8 + i * T::WireSize);
+        }
+        return valid;
+    }
+
     bool _parse(std::byte*& data, std::size_t& len) {
         if (!GodotT::_parse(data, len)) return false;
 
@@ -181,9 +248,16 @@ static_assert(sizeof(ArrayT<BoolT, 2>) == 24);
 
 template <uint32_t Size>
 struct PoolByteArrayT : GodotT<20> {
+    // Godot pads the bytes to a multiple of 4.
+    static constexpr std::size_t WireSize = 8 + (Size + 3) / 4 * 4;
+
     uint32_t _len = Size;
     std::array<uint8_t, Size> value;
 
+    static bool _check(const std::byte* data) {
+        return GodotT::_check(data) & (load_u32(data + 4) == Size);
+    }
+
     bool _parse(std::byte*& data, std::size_t& len) {
         if (!GodotT::_parse(data, len)) return false;
 
@@ -196,16 +270,104 @@ struct PoolByteArrayT : GodotT<20> {
     }
 };
 
+/// Like PoolByteArrayT, but with up to Capacity bytes. Only wire_size() of
+/// the WireSize bytes are sent, so it has to be the last field of a packet
+/// and the packet is sent with send_size().
+template <uint32_t Capacity>
+struct PoolByteVectorT : GodotT<20> {
+    static constexpr std::size_t WireSize = 8 + (Capacity + 3) / 4 * 4;
+
+    uint32_t _len = 0;
+    std::array<uint8_t, Capacity> value;
+
+    std::size_t wire_size() const {
+        return 8 + (_len + 3) / 4 * 4;
+    }
+
+    static bool _check(const std::byte* data) {
+        return GodotT::_check(data) & (load_u32(data + 4) <= Capacity);
+    }
+
+    bool _parse(std::byte*& data, std::size_t& len) {
+        if (!GodotT::_parse(data, len)) return false;
+
+        _len = *reinterpret_cast<uint32_t*&>(data);
+        if (_len > Capacity) return false;
+        if (!advance(data, len, sizeof(uint32_t))) return false;
+
+        const auto padded = (_len + 3) / 4 * 4;
+        if (len < padded) return false;
+        std::memcpy(&value[0], data, _len);
+        return advance(data, len, padded);
+    }
+};
+
+/// Values of ControlPacket::command.
+enum class Command : int32_t {
+    Snapshot = 0,
+    Restore = 1,
+    /// The next OSD update is a keyframe, for games that missed a delta.
+    OsdKeyframe = 2,
+};
+
+/// Maximum number of children a single ForkPacket can create.
+constexpr uint32_t MaxForkChildren = 8;
+
+/// Maximum number of motors of an airframe.
+constexpr uint32_t MaxMotors = 8;
+
+/// Maximum number of frames a single batch packet can advance.
+constexpr uint32_t MaxBatchFrames = 16;
+
+/// Size of the analog OSD screen in characters, as StateOsdUpdatePacket
+/// carries it.
+constexpr uint32_t OsdRows = 16;
+constexpr uint32_t OsdColumns = 30;
+constexpr uint32_t OsdSize = OsdRows * OsdColumns;
+
+/// Largest OSD canvas, the 60x22 grid of HD display ports.
+constexpr uint32_t MaxOsdRows = 22;
+constexpr uint32_t MaxOsdColumns = 60;
+constexpr uint32_t MaxOsdSize = MaxOsdRows * MaxOsdColumns;
+
+/// Room for every OSD cell as runs of at most 255 cells, see OsdDelta.
+constexpr uint32_t MaxOsdDeltaSize =
+  MaxOsdSize + 3 * ((MaxOsdSize + 254) / 255);
+
 #define S(...) __VA_ARGS__
 
-#define PACKET(name, size)     \
-    struct name : GodotT<19> { \
+/// Wire offsets of the packet fields, e.g. wire::StatePacket::rotation.
+namespace wire {
+#define PACKET(name, size) \
+    struct name {          \
+        enum Offset : std::size_t { _header = 7,
+
+#define FIELD(type, field) field, _##field##_end = field + type::WireSize - 1,
+
+#define END_PACKET() \
+    _end             \
+    }                \
+    ;                \
+    }                \
+    ;
+
+#include "packets.def"
+
+#undef FIELD
+#undef END_PACKET
+#undef PACKET
+}  // namespace wire
+
+#define PACKET(name, size)                                        \
+    struct name : GodotT<19> {                                    \
+        static constexpr std::size_t WireSize = wire::name::_end; \
         uint32_t _len = size;
 
 #define FIELD(type, name) type name;
 
 #define END_PACKET()                                 \
     bool _parse(std::byte*& data, std::size_t& len); \
+    static bool _check(const std::byte* data);       \
     }                                                \
     ;
 
@@ -231,11 +393,57 @@ struct PoolByteArrayT : GodotT<20> {
 
 #include "packets.def"
 
+#undef FIELD
+#undef END_PACKET
+#undef PACKET
+
+#define PACKET(name, size)                            \
+    inline bool name::_check(const std::byte* data) { \
+        using Offset = wire::name::Offset;            \
+        bool valid = GodotT::_check(data) &           \
+                     (load_u32(data + 4) == size);
+
+#define FIELD(type, field) valid &= type::_check(data + Offset::field);
+
+#define END_PACKET() \
+    return valid;    \
+    }
+
+#include "packets.def"
+
+#undef FIELD
+#undef END_PACKET
+#undef PACKET
+
+// send() writes the structs as they are, so their layout has to be the wire
+// layout. The packets aren't standard layout because of the GodotT base, but
+// offsetof works for them on every compiler we support.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+
+#define PACKET(name, size)                                 \
+    static_assert(sizeof(name) == name::WireSize,          \
+                  #name " doesn't match its wire layout"); \
+    static_assert(std::is_trivially_copyable_v<name>);     \
+    namespace detail::layout_##name {                      \
+    using Packet = ::name;                                 \
+    using Offset = wire::name::Offset;
+
+#define FIELD(type, field)                                  \
+    static_assert(offsetof(Packet, field) == Offset::field, \
+                  #field " doesn't match its wire offset");
+
+#define END_PACKET() }
+
+#include "packets.def"
+
 #undef FIELD
 #undef END_PACKET
 #undef PACKET
 #undef S
 
+#pragma GCC diagnostic pop
+
 constexpr auto InitPacketSize = sizeof(InitPacket);
 
 constexpr auto StatePacketSize = sizeof(StatePacket);
@@ -243,8 +451,38 @@ constexpr auto StatePacketSize = sizeof(StatePacket);
 constexpr auto StateUpdatePacketSize = sizeof(StateUpdatePacket);
 constexpr auto StateOsdUpdatePacketSize = sizeof(StateOsdUpdatePacket);
 
+/// The bytes of a StateOsdDeltaPacket that are sent, without the unused
+/// room for cells.
+inline std::size_t send_size(const StateOsdDeltaPacket& packet) {
+    return wire::StateOsdDeltaPacket::cells + packet.cells.wire_size();
+}
+
+constexpr auto BatchStatePacketSize = sizeof(BatchStatePacket);
+constexpr auto BatchStateUpdatePacketSize = sizeof(BatchStateUpdatePacket);
+
+/// Decodes a packet with straight-line checks of all type ids and lengths
+/// and a single copy. Only handles 32 bit numbers, returns false for
+/// anything else so the caller can fall back to parse<T>.
+template <typename T>
+bool decode(const std::byte* data, std::size_t len, T& packet) {
+    static_assert(sizeof(T) == T::WireSize);
+
+    if (len != sizeof(T) || !T::_check(data)) {
+        return false;
+    }
+
+    std::memcpy(&packet, data, sizeof(T));
+    return true;
+}
+
 template <typename T>
 std::optional<T> get(std::byte* cur, std::size_t len) {
+    if (len == sizeof(T) && T::_check(cur)) {
+        std::optional<T> packet(std::in_place);
+        std::memcpy(&*packet, cur, sizeof(T));
+        return packet;
+    }
+
     auto result = parse<T>(cur, len);
     if (len != 0) {
         return std::nullopt;
@@ -253,6 +491,37 @@ std::optional<T> get(std::byte* cur, std::size_t len) {
     return result;
 }
 
+inline bool is_stop(const std::byte* data, std::size_t len) {
+    return len == 4 && std::memcmp(data, "STOP", 4) == 0;
+}
+
+/// decode() straight into the variant, without copying the packet twice.
+template <typename T, typename Variant>
+bool decode_into(const std::byte* data,
+                 std::size_t len,
+                 std::optional<Variant>& result) {
+    if (len != sizeof(T) || !T::_check(data)) {
+        return false;
+    }
+
+    auto& packet = std::get<T>(result.emplace(std::in_place_type<T>));
+    std::memcpy(&packet, data, sizeof(T));
+    return true;
+}
+
+/// Parses the first packet type in Ts that matches the data.
+template <typename... Ts>
+std::optional<std::variant<Ts...>> get_any(std::byte* cur, std::size_t len) {
+    std::optional<std::variant<Ts...>> result;
+
+    // Packets that decode() handles need no parsing, try those first.
+    (void)(decode_into<Ts>(cur, len, result) || ...);
+    if (!result) {
+        (void)((result = get<Ts>(cur, len), result.has_value()) || ...);
+    }
+    return result;
+}
+
 template <typename T>
 void send(kissnet::udp_socket& send_socket, const T& packet) {
     auto [len, no_error] =
@@ -269,8 +538,7 @@ auto receive(kissnet::udp_socket& recv_socket)
     assert(no_error && "Error recv state packet");
 
     if constexpr (AllowStop) {
-        std::string str(reinterpret_cast<const char*>(&buf[0]), len);
-        if (str == "STOP") {
+        if (is_stop(&buf[0], len)) {
             return std::nullopt;
         }
     }
@@ -283,3 +551,20 @@ auto receive(kissnet::udp_socket& recv_socket)
         return *result;
     }
 }
+
+/// Receives one of the packets in Ts, returns nullopt on STOP.
+template <typename... Ts>
+std::optional<std::variant<Ts...>> receive_any(
+  kissnet::udp_socket& recv_socket) {
+    std::array<std::byte, 2 * std::max({sizeof(Ts)...})> buf;
+    auto [len, no_error] = recv_socket.recv(buf);
+    assert(no_error && "Error recv packet");
+
+    if (is_stop(&buf[0], len)) {
+        return std::nullopt;
+    }
+
+    auto result = get_any<Ts...>(&buf[0], len);
+    assert(result && "failed to parse received packet");
+    return result;
+}
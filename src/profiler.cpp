@@ -0,0 +1,101 @@
+#include "profiler.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+const char* const PHASE_NAMES[] = {
+  "receive", "dyad", "sensors", "scheduler", "physics", "send", "frame"};
+
+static_assert(std::size(PHASE_NAMES) == StepProfiler::PhaseCount);
+}  // namespace
+
+void StepProfiler::end_frame() {
+    if (!enabled) return;
+
+    for (auto i = 0u; i < PhaseCount; i++) {
+        phases[i].record(frame[i]);
+        frame[i] = 0;
+    }
+}
+
+void StepProfiler::clear() {
+    frame.fill(0);
+    for (auto& histogram : phases) {
+        histogram.clear();
+    }
+}
+
+void StepProfiler::print(std::FILE* file) const {
+    fmt::print(file,
+               "{:<10} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+               "phase",
+               "frames",
+               "p50 us",
+               "p90 us",
+               "p99 us",
+               "max us");
+
+    for (auto i = 0u; i < PhaseCount; i++) {
+        const auto& histogram = phases[i];
+        fmt::print(file,
+                   "{:<10} {:>10} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f}\n",
+                   PHASE_NAMES[i],
+                   histogram.count(),
+                   histogram.percentile(0.5) / 1e3,
+                   histogram.percentile(0.9) / 1e3,
+                   histogram.percentile(0.99) / 1e3,
+                   histogram.max() / 1e3);
+    }
+}
+
+void TaskProfiler::clear() {
+    for (auto& task : tasks) {
+        task = Task{task.name};
+    }
+}
+
+void TaskProfiler::print(std::FILE* file) const {
+    std::vector<const Task*> sorted;
+    for (const auto& task : tasks) {
+        if (task.count > 0) sorted.push_back(&task);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](auto* a, auto* b) {
+        return a->host_ns > b->host_ns;
+    });
+
+    fmt::print(file,
+               "{:<16} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+               "task",
+               "runs",
+               "total ms",
+               "mean us",
+               "max us",
+               "sim ms");
+
+    for (const auto* task : sorted) {
+        fmt::print(file,
+                   "{:<16} {:>10} {:>10.1f} {:>10.2f} {:>10.1f} {:>10.1f}\n",
+                   task->name,
+                   task->count,
+                   task->host_ns / 1e6,
+                   double(task->host_ns) / task->count / 1e3,
+                   task->max_host_ns / 1e3,
+                   task->sim_us / 1e3);
+    }
+}
+
+void TaskProfiler::write_csv(std::FILE* file) const {
+    fmt::print(file, "task,runs,host_ns,max_host_ns,sim_us\n");
+    for (const auto& task : tasks) {
+        fmt::print(file,
+                   "{},{},{},{},{}\n",
+                   task.name,
+                   task.count,
+                   task.host_ns,
+                   task.max_host_ns,
+                   task.sim_us);
+    }
+}
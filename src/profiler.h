@@ -0,0 +1,134 @@
+#pragma once
+
+#include "histogram.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+/// Host time in nanoseconds.
+inline uint64_t profiler_now() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count());
+}
+
+/// Times the phases of Simulator::step(). The time of each phase is summed
+/// over a frame and recorded in a histogram when the frame ends. While
+/// disabled a Scope costs a single branch.
+class StepProfiler {
+   public:
+    enum Phase {
+        /// Waiting for and decoding the packet from the game.
+        Receive,
+        Dyad,
+        Sensors,
+        Scheduler,
+        Physics,
+        Send,
+        /// The whole frame, from receive to send.
+        Frame,
+        PhaseCount
+    };
+
+    class Scope {
+        StepProfiler* profiler;
+        Phase phase;
+        uint64_t start = 0;
+
+       public:
+        Scope(StepProfiler& profiler, Phase phase)
+            : profiler(profiler.enabled ? &profiler : nullptr), phase(phase) {
+            if (this->profiler) start = profiler_now();
+        }
+
+        ~Scope() {
+            if (profiler) profiler->frame[phase] += profiler_now() - start;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+   private:
+    bool enabled = false;
+    std::array<uint64_t, PhaseCount> frame{};
+    std::array<Histogram, PhaseCount> phases;
+
+   public:
+    void enable(bool on) {
+        enabled = on;
+    }
+
+    bool is_enabled() const {
+        return enabled;
+    }
+
+    const Histogram& phase(Phase phase) const {
+        return phases[phase];
+    }
+
+    /// Records the phases of the current frame.
+    void end_frame();
+
+    void clear();
+
+    /// Prints p50/p90/p99/max of every phase in microseconds.
+    void print(std::FILE* file) const;
+};
+
+/// Counts the runs of every betaflight task and the host and simulated time
+/// they take. The simulator wraps the task functions when it initializes
+/// betaflight with the profiler enabled.
+class TaskProfiler {
+   public:
+    struct Task {
+        const char* name = nullptr;
+        uint64_t count = 0;
+        uint64_t host_ns = 0;
+        uint64_t max_host_ns = 0;
+        /// Simulated time the task held the scheduler, i.e. its delays.
+        uint64_t sim_us = 0;
+    };
+
+   private:
+    bool enabled = false;
+    std::vector<Task> tasks;
+
+   public:
+    void enable(bool on) {
+        enabled = on;
+    }
+
+    bool is_enabled() const {
+        return enabled;
+    }
+
+    void add(const char* name) {
+        tasks.push_back(Task{name});
+    }
+
+    void record(unsigned id, uint64_t host_ns, uint64_t sim_us) {
+        auto& task = tasks[id];
+        task.count++;
+        task.host_ns += host_ns;
+        task.max_host_ns = std::max(task.max_host_ns, host_ns);
+        task.sim_us += sim_us;
+    }
+
+    const std::vector<Task>& get_tasks() const {
+        return tasks;
+    }
+
+    /// Resets the counters, the tasks are kept.
+    void clear();
+
+    /// Prints the tasks that ran, most host time first.
+    void print(std::FILE* file) const;
+
+    /// Writes every task as a CSV row, with a header.
+    void write_csv(std::FILE* file) const;
+};
@@ -0,0 +1,54 @@
+#include "realtime.h"
+
+#include <fmt/format.h>
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+bool enable_realtime(const RealtimeOptions& options) {
+#ifdef __linux__
+    auto success = true;
+
+    if (options.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(options.cpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+            fmt::print("Failed to pin to cpu {}: {}\n",
+                       options.cpu,
+                       std::strerror(errno));
+            success = false;
+        }
+    }
+
+    if (options.fifo_priority > 0) {
+        // Page faults in the step loop would undo the priority.
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            fmt::print("Failed to lock memory: {}\n", std::strerror(errno));
+            success = false;
+        }
+
+        sched_param param{};
+        param.sched_priority = options.fifo_priority;
+        if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+            fmt::print("Failed to set SCHED_FIFO priority {}: {}\n",
+                       options.fifo_priority,
+                       std::strerror(errno));
+            success = false;
+        }
+    }
+
+    return success;
+#else
+    if (options.cpu >= 0 || options.fifo_priority > 0) {
+        fmt::print("Realtime scheduling is only supported on Linux\n");
+        return false;
+    }
+    return true;
+#endif
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+/// Scheduling of the thread that runs the step loop.
+struct RealtimeOptions {
+    /// Pins the thread to this cpu, -1 leaves it to the scheduler.
+    int cpu = -1;
+
+    /// Runs the thread under SCHED_FIFO with this priority and locks all
+    /// memory, 0 keeps the normal scheduler.
+    int fifo_priority = 0;
+};
+
+/// Applies options to the calling thread and prints what failed, usually
+/// missing permissions. Only supported on Linux.
+bool enable_realtime(const RealtimeOptions& options);
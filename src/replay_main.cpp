@@ -0,0 +1,53 @@
+#include "simulator.h"
+#include "transport.h"
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <memory>
+
+using hr_clock = std::chrono::high_resolution_clock;
+
+int main(int argc, char** argv) {
+    if (argc != 2 && argc != 3) {
+        fmt::print("usage: {} trace.bin [updates.bin]\n", argv[0]);
+        return 1;
+    }
+
+    auto transport =
+      std::make_unique<FileTransport>(argv[1], argc == 3 ? argv[2] : nullptr);
+    if (!transport->valid()) {
+        fmt::print("Failed to open {}\n", argv[1]);
+        return 1;
+    }
+
+    Simulator simulator(std::move(transport));
+    // Nobody is connected to the UARTs, don't wait for them every frame.
+    simulator.serial_enabled = false;
+    if (!simulator.connect()) {
+        fmt::print("no init packet in trace\n");
+        return 1;
+    }
+
+    const auto start_micros = simulator.micros_passed;
+    const auto start = hr_clock::now();
+
+    auto frames = 0ull;
+    while (simulator.step()) {
+        frames++;
+    }
+
+    const auto elapsed = std::chrono::duration<double>(hr_clock::now() - start);
+    const auto wall_us = elapsed.count() * 1e6;
+    const auto sim_us = double(simulator.micros_passed - start_micros);
+
+    fmt::print("frames: {}, wall time: {:.3f} s, simulated: {:.3f} s\n",
+               frames,
+               elapsed.count(),
+               sim_us / 1e6);
+    fmt::print("throughput: {:.1f} frames/s, {:.2f} sim us per wall us\n",
+               frames / elapsed.count(),
+               sim_us / wall_us);
+
+    return 0;
+}
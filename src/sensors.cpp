@@ -0,0 +1,85 @@
+#include "sensors.h"
+
+#include <algorithm>
+#include <cassert>
+
+SensorPipeline::SensorPipeline() {
+    set_timing(Gyro, {20000, 0});
+    set_timing(Acc, {1000, 0});
+    set_timing(Baro, {50, 0});
+    set_timing(Mag, {100, 0});
+    set_timing(Gps, {10, 0});
+}
+
+bool SensorPipeline::set_timing(Sensor sensor, const Timing& timing) {
+    if (timing.rate_hz > 1000000) return false;
+
+    // A sample is pushed before the delivered ones are popped, and a poll
+    // tick that doesn't divide the period can take a sample up to a period
+    // late, which leaves MaxInFlight - 2 periods for the latency.
+    const auto period = timing.rate_hz ? 1000000 / timing.rate_hz : 0;
+    if (timing.rate_hz && timing.latency_us > (MaxInFlight - 2) * period) {
+        return false;
+    }
+
+    timings[sensor] = timing;
+    periods_us[sensor] = period;
+    dirty = true;
+    return true;
+}
+
+void SensorPipeline::push(Sensor sensor, uint64_t now_us, const Value& value) {
+    auto& queue = state[sensor];
+    assert(queue.size < MaxInFlight && "Sensor latency too long");
+
+    const auto tail = (queue.head + queue.size) % MaxInFlight;
+    queue.deliver_us[tail] = now_us + timings[sensor].latency_us;
+    queue.values[tail] = value;
+    queue.size++;
+
+    // Keeps the rate when the poll ticks don't divide the period, but never
+    // catches up on missed samples.
+    queue.next_sample_us += periods_us[sensor];
+    if (queue.next_sample_us <= now_us) {
+        queue.next_sample_us = now_us + periods_us[sensor];
+    }
+
+    dirty = true;
+}
+
+void SensorPipeline::pop_due(Sensor sensor, uint64_t now_us, Value& value) {
+    auto& queue = state[sensor];
+
+    while (queue.size > 0 && queue.deliver_us[queue.head] <= now_us) {
+        value = queue.values[queue.head];
+        queue.head = (queue.head + 1) % MaxInFlight;
+        queue.size--;
+    }
+
+    dirty = true;
+}
+
+void SensorPipeline::set_state(const State& state) {
+    this->state = state;
+    dirty = true;
+}
+
+void SensorPipeline::update_next_event() {
+    dirty = false;
+    next_event_us = UINT64_MAX;
+    for (auto i = 0u; i < SensorCount; i++) {
+        const auto& queue = state[i];
+        if (periods_us[i] > 0) {
+            next_event_us = std::min(next_event_us, queue.next_sample_us);
+        }
+        if (queue.size > 0) {
+            next_event_us =
+              std::min(next_event_us, queue.deliver_us[queue.head]);
+        }
+    }
+}
+
+const char* SensorPipeline::name(Sensor sensor) {
+    static const char* names[] = {"gyro", "acc", "baro", "mag", "gps"};
+    return names[sensor];
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+/// When the fake sensors sample the simulated state and when betaflight
+/// sees the samples. Every sensor has its own rate and latency, samples
+/// wait in a small queue until their latency is over. Between events the
+/// simulator only compares next_event() with the current time.
+class SensorPipeline {
+   public:
+    enum Sensor : unsigned { Gyro, Acc, Baro, Mag, Gps, SensorCount };
+
+    struct Timing {
+        /// Samples per second, 0 disables the sensor. The sensors are only
+        /// polled at Simulator::Rates::sensor_hz, which caps this.
+        uint32_t rate_hz = 0;
+        /// Time from a sample to betaflight seeing it.
+        uint32_t latency_us = 0;
+    };
+
+    /// A sample in the units of the betaflight fake driver.
+    using Value = std::array<double, 4>;
+
+    /// Samples of one sensor that can wait for their latency at once.
+    static constexpr uint32_t MaxInFlight = 8;
+
+    struct Queue {
+        uint64_t next_sample_us = 0;
+        uint32_t head = 0;
+        uint32_t size = 0;
+        std::array<uint64_t, MaxInFlight> deliver_us{};
+        std::array<Value, MaxInFlight> values{};
+    };
+
+    /// Everything besides the timings, for snapshots.
+    using State = std::array<Queue, SensorCount>;
+
+   private:
+    std::array<Timing, SensorCount> timings;
+    std::array<uint32_t, SensorCount> periods_us{};
+    State state;
+    uint64_t next_event_us = 0;
+    /// Whether next_event_us has to be recomputed.
+    bool dirty = true;
+
+    void update_next_event();
+    void pop_due(Sensor sensor, uint64_t now_us, Value& value);
+
+   public:
+    /// Gyro at 20 kHz, acc at 1 kHz, baro at 50 Hz, mag at 100 Hz and GPS
+    /// at 10 Hz, all without latency.
+    SensorPipeline();
+
+    /// Returns false and keeps the timing unless the rate is at most 1 MHz
+    /// and the latency at most MaxInFlight - 2 sample periods.
+    bool set_timing(Sensor sensor, const Timing& timing);
+    const Timing& get_timing(Sensor sensor) const {
+        return timings[sensor];
+    }
+
+    /// No sample or delivery is due before this.
+    uint64_t next_event() {
+        if (dirty) update_next_event();
+        return next_event_us;
+    }
+
+    bool sample_due(Sensor sensor, uint64_t now_us) const {
+        return periods_us[sensor] > 0 &&
+               now_us >= state[sensor].next_sample_us;
+    }
+
+    /// Queues the sample taken at now_us and schedules the next one.
+    void push(Sensor sensor, uint64_t now_us, const Value& value);
+
+    /// Sets value to the newest sample whose latency is over and drops the
+    /// older ones, returns false if there is none.
+    bool pop(Sensor sensor, uint64_t now_us, Value& value) {
+        const auto& queue = state[sensor];
+        if (queue.size == 0 || queue.deliver_us[queue.head] > now_us) {
+            return false;
+        }
+        pop_due(sensor, now_us, value);
+        return true;
+    }
+
+    const State& get_state() const {
+        return state;
+    }
+
+    void set_state(const State& state);
+
+    static const char* name(Sensor sensor);
+};
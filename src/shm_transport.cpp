@@ -0,0 +1,298 @@
+#include "shm_transport.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <thread>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+constexpr uint32_t MAGIC = 0x4b574144;  // "KWAD"
+constexpr uint32_t VERSION = 1;
+
+constexpr uint32_t RING_SIZE = 1 << 20;
+constexpr uint32_t HEADER_SIZE = 8;
+constexpr uint32_t WRAP = 0xffffffff;
+
+/// Polls before sleeping on the futex. On a single cpu polling only delays
+/// the other side.
+int spin_count() {
+    static const int count =
+      std::thread::hardware_concurrency() > 1 ? 1000 : 0;
+    return count;
+}
+
+static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "ring size must be pow2");
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+uint32_t record_size(std::size_t len) {
+    return HEADER_SIZE + ((uint32_t(len) + 7u) & ~7u);
+}
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+}  // namespace
+
+/// head and tail count bytes and wrap around at 2^32, which is a multiple of
+/// the ring size. Records start with a uint32_t length and are 8 byte
+/// aligned, a record that doesn't fit before the end of the ring is
+/// preceded by a WRAP marker and starts at offset 0 instead.
+struct ShmTransport::Ring {
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+
+    /// Set while the consumer might sleep on signal.
+    alignas(64) std::atomic<uint32_t> waiting;
+    std::atomic<uint32_t> signal;
+    std::atomic<uint32_t> closed;
+
+    alignas(64) std::byte data[RING_SIZE];
+};
+
+struct ShmTransport::Segment {
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+
+    Ring to_simulator;
+    Ring to_game;
+};
+
+#ifdef __linux__
+namespace {
+void futex_wait(std::atomic<uint32_t>& word, uint32_t value) {
+    syscall(SYS_futex, &word, FUTEX_WAIT, value, nullptr, nullptr, 0);
+}
+
+void futex_wake(std::atomic<uint32_t>& word) {
+    syscall(SYS_futex, &word, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+
+/// Wakes the consumer of ring if it is (about to be) sleeping, returns
+/// whether that took a syscall.
+bool notify(ShmTransport::Ring& ring) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ring.waiting.load(std::memory_order_relaxed)) {
+        ring.signal.fetch_add(1);
+        futex_wake(ring.signal);
+        return true;
+    }
+    return false;
+}
+}  // namespace
+
+ShmTransport::ShmTransport(const std::string& name, Side side, bool futex)
+    : name(name), side(side), futex(futex) {
+    const auto create = side == Side::Simulator;
+    const auto flags = create ? O_CREAT | O_TRUNC | O_RDWR : O_RDWR;
+    const auto fd = shm_open(name.c_str(), flags, 0600);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat info;
+    if (create && ftruncate(fd, sizeof(Segment)) != 0) {
+        close(fd);
+        return;
+    }
+    if (fstat(fd, &info) != 0 || std::size_t(info.st_size) < sizeof(Segment)) {
+        close(fd);
+        return;
+    }
+
+    void* memory = mmap(nullptr,
+                        sizeof(Segment),
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED,
+                        fd,
+                        0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return;
+    }
+
+    // A new segment is zero filled, which is an empty ring.
+    auto* shared = static_cast<Segment*>(memory);
+    if (create) {
+        shared->version = VERSION;
+        shared->magic.store(MAGIC, std::memory_order_release);
+    } else if (shared->magic.load(std::memory_order_acquire) != MAGIC ||
+               shared->version != VERSION) {
+        munmap(memory, sizeof(Segment));
+        return;
+    }
+
+    segment = shared;
+    owner = getpid();
+    if (create) {
+        recv_ring = &segment->to_simulator;
+        send_ring = &segment->to_game;
+    } else {
+        recv_ring = &segment->to_game;
+        send_ring = &segment->to_simulator;
+    }
+}
+
+ShmTransport::~ShmTransport() {
+    if (!segment) {
+        return;
+    }
+
+    const auto owned = getpid() == owner;
+    if (owned) {
+        send_ring->closed.store(1);
+        send_ring->signal.fetch_add(1);
+        futex_wake(send_ring->signal);
+    }
+
+    munmap(segment, sizeof(Segment));
+    if (owned && side == Side::Simulator) {
+        shm_unlink(name.c_str());
+    }
+}
+
+bool ShmTransport::valid() const {
+    return segment != nullptr;
+}
+
+std::optional<Transport::View> ShmTransport::recv() {
+    auto& ring = *recv_ring;
+    auto tail = ring.tail.load(std::memory_order_relaxed);
+
+    if (pending) {
+        tail += pending;
+        pending = 0;
+        ring.tail.store(tail, std::memory_order_release);
+    }
+
+    auto spins = 0;
+    while (true) {
+        const auto head = ring.head.load(std::memory_order_acquire);
+        if (head != tail) {
+            const auto offset = tail & (RING_SIZE - 1);
+            uint32_t len;
+            std::memcpy(&len, &ring.data[offset], sizeof(len));
+
+            if (len == WRAP) {
+                tail += RING_SIZE - offset;
+                ring.tail.store(tail, std::memory_order_release);
+                continue;
+            }
+
+            pending = record_size(len);
+            stats.received++;
+            return View{&ring.data[offset + HEADER_SIZE], len};
+        }
+
+        if (ring.closed.load(std::memory_order_acquire)) {
+            if (ring.head.load(std::memory_order_acquire) == tail) {
+                return std::nullopt;
+            }
+            continue;
+        }
+
+        if (!futex || spins < spin_count()) {
+            spins++;
+            cpu_relax();
+            continue;
+        }
+
+        ring.waiting.store(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto signal = ring.signal.load();
+        if (ring.head.load() == tail && !ring.closed.load()) {
+            futex_wait(ring.signal, signal);
+            stats.syscalls++;
+        }
+        ring.waiting.store(0, std::memory_order_relaxed);
+        spins = 0;
+    }
+}
+
+void ShmTransport::send(const std::byte* data, std::size_t len) {
+    std::memcpy(reserve(len), data, len);
+    commit();
+}
+
+std::byte* ShmTransport::reserve(std::size_t len) {
+    auto& ring = *send_ring;
+    const auto size = record_size(len);
+    assert(size <= RING_SIZE / 2 && "Packet too large for the ring");
+
+    auto head = ring.head.load(std::memory_order_relaxed);
+    const auto offset = head & (RING_SIZE - 1);
+    const auto skip = RING_SIZE - offset < size ? RING_SIZE - offset : 0;
+
+    // Waits for the consumer if the ring is full, nobody reads the packet
+    // if the other side is gone.
+    while (RING_SIZE - (head - ring.tail.load(std::memory_order_acquire)) <
+           skip + size) {
+        if (recv_ring->closed.load(std::memory_order_relaxed)) {
+            reserved_head = std::nullopt;
+            return Transport::reserve(len);
+        }
+        cpu_relax();
+    }
+
+    if (skip) {
+        std::memcpy(&ring.data[offset], &WRAP, sizeof(WRAP));
+        head += skip;
+    }
+
+    const auto start = head & (RING_SIZE - 1);
+    const auto length = uint32_t(len);
+    std::memcpy(&ring.data[start], &length, sizeof(length));
+
+    reserved_head = head + size;
+    return &ring.data[start + HEADER_SIZE];
+}
+
+void ShmTransport::commit() {
+    if (!reserved_head) {
+        return;
+    }
+
+    send_ring->head.store(*reserved_head, std::memory_order_release);
+    reserved_head = std::nullopt;
+    stats.sent++;
+    if (notify(*send_ring)) {
+        stats.syscalls++;
+    }
+}
+#else
+ShmTransport::ShmTransport(const std::string& name, Side side, bool futex)
+    : name(name), side(side), futex(futex) {
+}
+
+ShmTransport::~ShmTransport() = default;
+
+bool ShmTransport::valid() const {
+    return false;
+}
+
+std::optional<Transport::View> ShmTransport::recv() {
+    return std::nullopt;
+}
+
+void ShmTransport::send(const std::byte*, std::size_t) {
+}
+
+std::byte* ShmTransport::reserve(std::size_t len) {
+    return Transport::reserve(len);
+}
+
+void ShmTransport::commit() {
+}
+#endif
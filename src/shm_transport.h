@@ -0,0 +1,61 @@
+#pragma once
+
+#include "transport.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+/// Two lock-free single producer, single consumer rings in a shared memory
+/// segment (/dev/shm on Linux). Packets are the same as over UDP, but
+/// sending one is a copy into the ring and receiving one doesn't copy at
+/// all. An empty ring is polled for a while, after that the receiver either
+/// sleeps on a futex until the sender wakes it, or keeps spinning.
+/// Only supported on Linux, valid() is false elsewhere.
+class ShmTransport : public Transport {
+   public:
+    static constexpr const char* DEFAULT_NAME = "/kwadsim";
+
+    /// The simulator creates the segment, the game opens it.
+    enum class Side { Simulator, Game };
+
+    struct Segment;
+    struct Ring;
+
+   private:
+    std::string name;
+    Side side;
+    bool futex;
+
+    Segment* segment = nullptr;
+    /// pid of the process that opened the segment. A forked child only
+    /// unmaps it, closing the ring is up to the owner.
+    int owner = 0;
+    Ring* recv_ring = nullptr;
+    Ring* send_ring = nullptr;
+
+    /// Size of the record returned by the last recv(), it is only released
+    /// to the sender on the next call so the view stays valid.
+    uint32_t pending = 0;
+
+    /// Head of the send ring after the reserved packet is committed.
+    std::optional<uint32_t> reserved_head;
+
+   public:
+    ShmTransport(const std::string& name, Side side, bool futex = true);
+    ~ShmTransport() override;
+
+    ShmTransport(const ShmTransport&) = delete;
+    ShmTransport& operator=(const ShmTransport&) = delete;
+
+    bool valid() const;
+
+    /// Returns nullopt once the other side is closed and the ring is empty.
+    std::optional<View> recv() override;
+    void send(const std::byte* data, std::size_t len) override;
+
+    /// Reserves the packet directly in the ring.
+    std::byte* reserve(std::size_t len) override;
+    void commit() override;
+};
@@ -0,0 +1,236 @@
+#pragma once
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <cmath>
+
+/// Minimal float vector wrapper, uses AVX or SSE2 when the compiler targets
+/// them and falls back to scalar code otherwise.
+namespace simd {
+
+#if defined(__AVX__)
+
+constexpr int width = 8;
+
+struct vfloat {
+    __m256 v;
+};
+
+inline vfloat broadcast(float f) {
+    return {_mm256_set1_ps(f)};
+}
+
+inline vfloat operator+(vfloat a, vfloat b) {
+    return {_mm256_add_ps(a.v, b.v)};
+}
+
+inline vfloat operator-(vfloat a, vfloat b) {
+    return {_mm256_sub_ps(a.v, b.v)};
+}
+
+inline vfloat operator*(vfloat a, vfloat b) {
+    return {_mm256_mul_ps(a.v, b.v)};
+}
+
+inline vfloat operator/(vfloat a, vfloat b) {
+    return {_mm256_div_ps(a.v, b.v)};
+}
+
+inline vfloat min(vfloat a, vfloat b) {
+    return {_mm256_min_ps(a.v, b.v)};
+}
+
+inline vfloat max(vfloat a, vfloat b) {
+    return {_mm256_max_ps(a.v, b.v)};
+}
+
+inline vfloat sqrt(vfloat a) {
+    return {_mm256_sqrt_ps(a.v)};
+}
+
+inline vfloat abs(vfloat a) {
+    return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)};
+}
+
+/// Rounds to the nearest integer.
+inline vfloat round(vfloat a) {
+    return {
+      _mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)};
+}
+
+inline vfloat operator>(vfloat a, vfloat b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)};
+}
+
+inline vfloat operator<(vfloat a, vfloat b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)};
+}
+
+inline vfloat operator==(vfloat a, vfloat b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ)};
+}
+
+/// Lanes of a where mask is set, b elsewhere.
+inline vfloat select(vfloat mask, vfloat a, vfloat b) {
+    return {_mm256_blendv_ps(b.v, a.v, mask.v)};
+}
+
+#elif defined(__SSE2__)
+
+constexpr int width = 4;
+
+struct vfloat {
+    __m128 v;
+};
+
+inline vfloat broadcast(float f) {
+    return {_mm_set1_ps(f)};
+}
+
+inline vfloat operator+(vfloat a, vfloat b) {
+    return {_mm_add_ps(a.v, b.v)};
+}
+
+inline vfloat operator-(vfloat a, vfloat b) {
+    return {_mm_sub_ps(a.v, b.v)};
+}
+
+inline vfloat operator*(vfloat a, vfloat b) {
+    return {_mm_mul_ps(a.v, b.v)};
+}
+
+inline vfloat operator/(vfloat a, vfloat b) {
+    return {_mm_div_ps(a.v, b.v)};
+}
+
+inline vfloat min(vfloat a, vfloat b) {
+    return {_mm_min_ps(a.v, b.v)};
+}
+
+inline vfloat max(vfloat a, vfloat b) {
+    return {_mm_max_ps(a.v, b.v)};
+}
+
+inline vfloat sqrt(vfloat a) {
+    return {_mm_sqrt_ps(a.v)};
+}
+
+inline vfloat abs(vfloat a) {
+    return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)};
+}
+
+/// Rounds to the nearest integer, only for values that fit an int32.
+inline vfloat round(vfloat a) {
+    return {_mm_cvtepi32_ps(_mm_cvtps_epi32(a.v))};
+}
+
+inline vfloat operator>(vfloat a, vfloat b) {
+    return {_mm_cmpgt_ps(a.v, b.v)};
+}
+
+inline vfloat operator<(vfloat a, vfloat b) {
+    return {_mm_cmplt_ps(a.v, b.v)};
+}
+
+inline vfloat operator==(vfloat a, vfloat b) {
+    return {_mm_cmpeq_ps(a.v, b.v)};
+}
+
+/// Lanes of a where mask is set, b elsewhere.
+inline vfloat select(vfloat mask, vfloat a, vfloat b) {
+    return {_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v))};
+}
+
+#else
+
+constexpr int width = 1;
+
+struct vfloat {
+    float v;
+};
+
+inline vfloat broadcast(float f) {
+    return {f};
+}
+
+inline vfloat operator+(vfloat a, vfloat b) {
+    return {a.v + b.v};
+}
+
+inline vfloat operator-(vfloat a, vfloat b) {
+    return {a.v - b.v};
+}
+
+inline vfloat operator*(vfloat a, vfloat b) {
+    return {a.v * b.v};
+}
+
+inline vfloat operator/(vfloat a, vfloat b) {
+    return {a.v / b.v};
+}
+
+inline vfloat min(vfloat a, vfloat b) {
+    return {b.v < a.v ? b.v : a.v};
+}
+
+inline vfloat max(vfloat a, vfloat b) {
+    return {a.v < b.v ? b.v : a.v};
+}
+
+inline vfloat sqrt(vfloat a) {
+    return {std::sqrt(a.v)};
+}
+
+inline vfloat abs(vfloat a) {
+    return {std::fabs(a.v)};
+}
+
+/// Rounds to the nearest integer.
+inline vfloat round(vfloat a) {
+    return {std::nearbyint(a.v)};
+}
+
+inline vfloat operator>(vfloat a, vfloat b) {
+    return {a.v > b.v ? 1.0f : 0.0f};
+}
+
+inline vfloat operator<(vfloat a, vfloat b) {
+    return {a.v < b.v ? 1.0f : 0.0f};
+}
+
+inline vfloat operator==(vfloat a, vfloat b) {
+    return {a.v == b.v ? 1.0f : 0.0f};
+}
+
+/// Lanes of a where mask is set, b elsewhere.
+inline vfloat select(vfloat mask, vfloat a, vfloat b) {
+    return {mask.v != 0.0f ? a.v : b.v};
+}
+
+#endif
+
+inline vfloat operator-(vfloat a) {
+    return broadcast(0.0f) - a;
+}
+
+inline vfloat& operator+=(vfloat& a, vfloat b) {
+    return a = a + b;
+}
+
+inline vfloat clamp(vfloat x, vfloat lo, vfloat hi) {
+    return min(max(x, lo), hi);
+}
+
+inline float get(const vfloat& v, int lane) {
+    return reinterpret_cast<const float*>(&v.v)[lane];
+}
+
+inline void set(vfloat& v, int lane, float f) {
+    reinterpret_cast<float*>(&v.v)[lane] = f;
+}
+
+}  // namespace simd
@@ -3,7 +3,23 @@
 #include "packets.h"
 #include "vector_math.h"
 
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cmath>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 extern "C" {
 #include "dyad.h"
@@ -23,6 +39,8 @@ extern "C" {
 #include "sensors/sensors.h"
 
 #include "drivers/accgyro/accgyro_fake.h"
+#include "drivers/barometer/barometer_fake.h"
+#include "drivers/compass/compass_fake.h"
 #include "drivers/pwm_output.h"
 #include "drivers/pwm_output_fake.h"
 
@@ -31,6 +49,9 @@ extern "C" {
 #include "io/displayport_fake.h"
 #include "io/gps.h"
 
+#include "drivers/serial.h"
+#include "drivers/serial_tcp.h"
+
 #include "src/target.h"
 
 #undef ENABLE_STATE
@@ -52,217 +73,513 @@ const static auto RAD2DEG = (180.0f / float(M_PI));
 const static auto ACC_SCALE = (256 / 9.80665f);
 
 const static auto OSD_UPDATE_TIME = 1e6 / 60;
+// With delta updates, every n-th OSD update is a keyframe, so a game that
+// lost a delta catches up within a second.
+const static auto OSD_KEYFRAME_INTERVAL = 60u;
+
+// 25 degrees, in centidegrees.
+const static auto BARO_TEMPERATURE = 2500.0;
+// Earth's magnetic field in Gauss in the world frame, north is -z.
+const static auto MAG_FIELD = vmath::vec3{0, -0.42f, -0.22f};
+// LSB per Gauss, as the HMC5883L.
+const static auto MAG_SCALE = 1090.0f;
+
+static_assert(std::size(bf::motorsPwm) >= MaxMotors,
+              "betaflight has fewer motor outputs than an airframe");
+
+#ifdef __linux__
+// The .data and .bss of the betaflight objects, see betaflight_data.ld.
+// Weak, binaries linked without the script don't support snapshots.
+extern "C" {
+extern char __betaflight_data_start[] __attribute__((weak));
+extern char __betaflight_data_end[] __attribute__((weak));
+extern char __betaflight_bss_start[] __attribute__((weak));
+extern char __betaflight_bss_end[] __attribute__((weak));
+}
+#endif
+
+static_assert(std::size(bf::osdScreen) == MaxOsdRows &&
+                std::size(bf::osdScreen[0]) == MaxOsdColumns,
+              "the OSD packets don't match the fake display port");
+
+using TaskFunc = void (*)(bf::timeUs_t);
+
+// The functions of the wrapped betaflight tasks.
+static std::array<TaskFunc, bf::TASK_COUNT> task_funcs;
+
+template <unsigned Id>
+static void profiled_task(bf::timeUs_t currentTimeUs) {
+    auto& simulator = Simulator::getInstance();
+    if (!simulator.task_profiler.is_enabled()) {
+        task_funcs[Id](currentTimeUs);
+        return;
+    }
+
+    // The scheduler only runs once the last sleep is over, so whatever
+    // sleep_timer is after the task is the delay it asked for.
+    const auto start = profiler_now();
+    task_funcs[Id](currentTimeUs);
+    simulator.task_profiler.record(Id,
+                                   profiler_now() - start,
+                                   uint64_t(std::max(simulator.sleep_timer,
+                                                     int64_t(0))));
+}
+
+static const char* task_name(unsigned id) {
+#ifdef USE_TASK_STATISTICS
+    return bf::cfTasks[id].taskName;
+#else
+    static std::array<char[12], bf::TASK_COUNT> names;
+    std::snprintf(names[id], sizeof(names[id]), "task %u", id);
+    return names[id];
+#endif
+}
+
+template <unsigned... Ids>
+static void wrap_tasks(TaskProfiler& profiler,
+                       std::integer_sequence<unsigned, Ids...>) {
+    auto wrap = [&](unsigned id, TaskFunc wrapper) {
+        profiler.add(task_name(id));
+        task_funcs[id] = bf::cfTasks[id].taskFunc;
+        if (task_funcs[id]) bf::cfTasks[id].taskFunc = wrapper;
+    };
+    (wrap(Ids, &profiled_task<Ids>), ...);
+}
 
-const auto AIR_RHO = 1.225f;
+namespace {
+int16_t to_raw(double value) {
+    return int16_t(std::clamp(value, -32767.0, 32767.0));
+}
 
-// 20kHz scheduler, is enough to run PID at 8khz
-const auto FREQUENCY = 20e3;
-const auto DELTA = 1e6 / FREQUENCY;
+// Standard atmosphere at the altitude in meters, in Pa.
+double pressure(double altitude) {
+    return 101325 * std::pow(1 - 2.25577e-5 * altitude, 5.25588);
+}
+}  // namespace
 
-void Simulator::set_gyro(const StatePacket& state,
-                         const vmath::vec3& acceleration) {
+void Simulator::update_sensors(const vmath::vec3& pos,
+                               const Body& body,
+                               const vmath::vec3& acceleration) {
     using namespace vmath;
-    mat3 basis = state.rotation.value;
+    using Sensor = SensorPipeline::Sensor;
 
-    vec3 pos = state.position.value;
-    quat rotation = mat3_to_quat(basis);
-    vec3 gyro = xform_inv(basis, state.angularVelocity.value);
+    const auto now = micros_passed;
+    if (now < sensors.next_event()) return;
 
-    vec3 accelerometer =
-      xform_inv(basis, acceleration) / init_packet.quad_mass.value;
+    const quat& rotation = body.rotation;
+    SensorPipeline::Value value;
 
-    int16_t x, y, z;
-    if (bf::sensors(bf::SENSOR_ACC)) {
+    if (sensors.sample_due(Sensor::Gyro, now)) {
+        auto gyro = rotate_inv(rotation, body.angularVelocity) * RAD2DEG;
+        if (gyro_noise.enabled()) {
+            std::array<float, MaxMotors> rpm;
+            for (auto i = 0u; i < MaxMotors; i++) rpm[i] = motorsState[i].rpm;
+            gyro = gyro + gyro_noise.sample(now, rpm);
+        }
+        gyro = gyro * GYRO_SCALE;
+        sensors.push(Sensor::Gyro, now, {-gyro[2], -gyro[0], gyro[1], 0});
+    }
+    if (sensors.pop(Sensor::Gyro, now, value)) {
+        bf::fakeGyroSet(bf::fakeGyroDev,
+                        to_raw(value[0]),
+                        to_raw(value[1]),
+                        to_raw(value[2]));
+    }
+
+    if (sensors.sample_due(Sensor::Acc, now)) {
+#ifdef USE_QUAT_ORIENTATION
+        sensors.push(Sensor::Acc,
+                     now,
+                     {rotation[3], -rotation[2], rotation[0], -rotation[1]});
+#else
+        const auto accelerometer = rotate_inv(rotation, acceleration) *
+                                   (airframe.inv_mass * ACC_SCALE);
+        sensors.push(
+          Sensor::Acc,
+          now,
+          {-accelerometer[2], accelerometer[0], -accelerometer[1], 0});
+#endif
+    }
+    if (sensors.pop(Sensor::Acc, now, value) && bf::sensors(bf::SENSOR_ACC)) {
 #ifdef USE_QUAT_ORIENTATION
         bf::imuSetAttitudeQuat(
-          rotation[3], -rotation[2], rotation[0], -rotation[1]);
+          float(value[0]), float(value[1]), float(value[2]), float(value[3]));
 #else
-        x = int16_t(
-          bf::constrain(int(-accelerometer[2] * ACC_SCALE), -32767, 32767));
-        y = int16_t(
-          bf::constrain(int(accelerometer[0] * ACC_SCALE), -32767, 32767));
-        z = int16_t(
-          bf::constrain(int(-accelerometer[1] * ACC_SCALE), -32767, 32767));
-        bf::fakeAccSet(bf::fakeAccDev, x, y, z);
+        bf::fakeAccSet(bf::fakeAccDev,
+                       to_raw(value[0]),
+                       to_raw(value[1]),
+                       to_raw(value[2]));
 #endif
     }
 
-    x = int16_t(
-      bf::constrain(int(-gyro[2] * GYRO_SCALE * RAD2DEG), -32767, 32767));
-    y = int16_t(
-      bf::constrain(int(-gyro[0] * GYRO_SCALE * RAD2DEG), -32767, 32767));
-    z = int16_t(
-      bf::constrain(int(gyro[1] * GYRO_SCALE * RAD2DEG), -32767, 32767));
-    bf::fakeGyroSet(bf::fakeGyroDev, x, y, z);
+    if (sensors.sample_due(Sensor::Baro, now)) {
+        sensors.push(Sensor::Baro, now, {pressure(pos[1]), BARO_TEMPERATURE});
+    }
+    if (sensors.pop(Sensor::Baro, now, value)) {
+        bf::fakeBaroSet(int32_t(value[0]), int32_t(value[1]));
+    }
+
+    if (sensors.sample_due(Sensor::Mag, now)) {
+        const auto field = rotate_inv(rotation, MAG_FIELD) * MAG_SCALE;
+        sensors.push(Sensor::Mag, now, {-field[2], field[0], -field[1], 0});
+    }
+    if (sensors.pop(Sensor::Mag, now, value)) {
+        bf::fakeMagSet(to_raw(value[0]), to_raw(value[1]), to_raw(value[2]));
+    }
 
     const auto
       DISTANCE_BETWEEN_TWO_LONGITUDE_POINTS_AT_EQUATOR_IN_HUNDREDS_OF_KILOMETERS =
         1.113195f;
     const auto cosLon0 = 0.63141842418f;
 
-    // set gps:
-    static int64_t last_millis = 0;
-    int64_t millis = micros_passed / 1000;
-
-    if (millis - last_millis > 100) {
-        bf::EnableState(bf::GPS_FIX);
-        bf::gpsSol.numSat = 10;
-        bf::gpsSol.llh.lat =
+    if (sensors.sample_due(Sensor::Gps, now)) {
+        const auto lat =
           int32_t(
             -pos[2] * 100 /
             DISTANCE_BETWEEN_TWO_LONGITUDE_POINTS_AT_EQUATOR_IN_HUNDREDS_OF_KILOMETERS) +
           508445910;
-        bf::gpsSol.llh.lon =
+        const auto lon =
           int32_t(
             pos[0] * 100 /
             (cosLon0 *
              DISTANCE_BETWEEN_TWO_LONGITUDE_POINTS_AT_EQUATOR_IN_HUNDREDS_OF_KILOMETERS)) +
           43551050;
-        bf::gpsSol.llh.altCm = int32_t(pos[1] * 100);
-        bf::gpsSol.groundSpeed =
-          uint16_t(length(state.linearVelocity.value) * 100);
+        sensors.push(Sensor::Gps,
+                     now,
+                     {double(lat),
+                      double(lon),
+                      pos[1] * 100.0,
+                      length(body.linearVelocity) * 100.0});
+    }
+    if (sensors.pop(Sensor::Gps, now, value)) {
+        bf::EnableState(bf::GPS_FIX);
+        bf::gpsSol.numSat = 10;
+        bf::gpsSol.llh.lat = int32_t(value[0]);
+        bf::gpsSol.llh.lon = int32_t(value[1]);
+        bf::gpsSol.llh.altCm = int32_t(value[2]);
+        bf::gpsSol.groundSpeed = uint16_t(value[3]);
         bf::GPS_update |= bf::GPS_MSP_UPDATE;
-
-        last_millis = millis;
     }
 }
 
-float Simulator::motor_torque(float volts, float rpm) {
-    auto current =
-      (volts - rpm / init_packet.motor_kv.value) / init_packet.motor_R.value;
-
-    if (current > 0)
-        current = std::max(0.0f, current - init_packet.motor_I0.value);
-    else if (current < 0)
-        current = std::min(0.0f, current + init_packet.motor_I0.value);
-    return current * 60 / (init_packet.motor_kv.value * 2.0f * float(M_PI));
+// Air speed through the props.
+static float prop_velocity(const vmath::quat& rotation,
+                           const vmath::vec3& linearVelocity) {
+    const auto up = vmath::rotate(rotation, {0, 1, 0});
+    return std::max(0.0f, vmath::dot(linearVelocity, up));
 }
 
-float Simulator::prop_thrust(float rpm, float vel) {
-    using namespace vmath;
-    // max thrust vs velocity:
-    auto propF = init_packet.prop_thrust_factors.value[0].value * vel * vel +
-                 init_packet.prop_thrust_factors.value[1].value * vel +
-                 init_packet.prop_thrust_factors.value[2].value;
-    const auto max_rpm = init_packet.prop_max_rpm.value;
-    const auto prop_a = init_packet.prop_a_factor.value;
-    propF = std::max(0.0f, propF);
-
-    // thrust vs rpm (and max thrust)
-    const auto b = (propF - prop_a * max_rpm * max_rpm) / max_rpm;
-    const auto result = b * rpm + prop_a * rpm * rpm;
-
-    return std::max(result, 0.0f);
+Simulator::Body Simulator::Body::from_state(const StatePacket& state) {
+    Body body;
+    body.rotation = vmath::mat3_to_quat(state.rotation.value);
+    body.angularVelocity = state.angularVelocity.value;
+    body.linearVelocity = state.linearVelocity.value;
+    return body;
 }
 
-float Simulator::prop_torque(float rpm, float vel) {
-    return prop_thrust(rpm, vel) * init_packet.prop_torque_factor.value;
+void Simulator::Body::to_state(StatePacket& state) const {
+    state.rotation.value = vmath::quat_to_mat3(rotation);
+    state.angularVelocity.value = angularVelocity;
+    state.linearVelocity.value = linearVelocity;
 }
 
-float Simulator::calculate_motors(float dt,
-                                  const StatePacket& state,
-                                  std::array<MotorState, 4>& motors) {
+template <unsigned N>
+float Simulator::calculate_motors(float dt, const Body& body, Motors& motors) {
     using namespace vmath;
 
-    const float motor_dir[4] = {1.0, -1.0, -1.0, 1.0};
-
     float resPropTorque = 0;
 
-    const auto up = get_axis(state.rotation.value, 1);
-
-    for (int i = 0; i < 4; i++) {
-        // const auto r = xform(state.rotation.value, motors[i].position);
-        const auto linVel = state.linearVelocity.value;
-        const auto vel = std::max(0.0f, dot(linVel, up));
+    const auto vel = prop_velocity(body.rotation, body.linearVelocity);
 
+    for (auto i = 0u; i < N; i++) {
         auto rpm = motors[i].rpm;
 
-        const auto volts =
-          bf::motorsPwm[i] / 1000.0f * init_packet.quad_vbat.value;
-        const auto torque = motor_torque(volts, rpm);
-
-        const auto ptorque = prop_torque(rpm, vel);
-        const auto net_torque = torque - ptorque;
-        const auto domega = net_torque / init_packet.prop_inertia.value;
-        const auto drpm = (domega * dt) * 60.0f / (2.0f * float(M_PI));
+        const auto volts = airframe.motor_volts(bf::motorsPwm[i]);
+        const auto torque = airframe.motor_torque(volts, rpm);
+        const auto drpm = airframe.rpm_rate(torque, rpm, vel) * dt;
 
-        const auto kv = init_packet.motor_kv.value;
-        const auto maxdrpm = fabsf(volts * init_packet.motor_kv.value - rpm);
+        const auto maxdrpm = fabsf(volts * airframe.kv - rpm);
         rpm += clamp(drpm, -maxdrpm, maxdrpm);
 
-        motors[i].thrust = prop_thrust(rpm, vel);
+        motors[i].thrust = airframe.prop_thrust(rpm, vel);
         motors[i].rpm = rpm;
-        resPropTorque += motor_dir[i] * torque;
+        resPropTorque += airframe.motor_dir[i] * torque;
     }
 
     return resPropTorque;
 }
 
-void Simulator::update_rotation(float dt, StatePacket& state) {
-    using namespace vmath;
-    const auto w = state.angularVelocity.value * dt;
-    const mat3 W = {
-      vec3{1, -w[2], w[1]}, vec3{w[2], 1, -w[0]}, vec3{-w[1], w[0], 1}};
-    state.rotation.value = W * state.rotation.value;
+void Simulator::update_rotation(float dt, Body& body) {
+    body.rotation = vmath::integrate(body.rotation, body.angularVelocity, dt);
 }
 
-vmath::vec3 Simulator::calculate_physics(
-  float dt,
-  StatePacket& state,
-  const std::array<MotorState, 4>& motors,
-  float motorsTorque) {
+template <unsigned N>
+vmath::vec3 Simulator::body_force(const vmath::quat& rotation,
+                                  const vmath::vec3& linearVelocity,
+                                  const Motors& motors) const {
     using namespace vmath;
-    vec3 acceleration;
-
-    auto gravity_force = vec3{0, -9.81f * init_packet.quad_mass.value, 0};
 
     // force sum:
-    vec3 total_force = gravity_force;
+    vec3 total_force = vec3{0, airframe.gravity, 0};
 
     // drag:
-    float vel2 = length2(state.linearVelocity.value);
-    auto dir = normalize(state.linearVelocity.value);
-    auto local_dir = xform_inv(state.rotation.value, dir);
-    float area = dot(init_packet.frame_drag_area.value, abs(local_dir));
-    total_force = total_force - dir * 0.5 * AIR_RHO * vel2 *
-                                  init_packet.frame_drag_constant.value * area;
-
-    // motors:
-    for (auto i = 0u; i < 4; i++) {
-        total_force = total_force +
-                      xform(state.rotation.value, vec3{0, motors[i].thrust, 0});
+    float vel2 = length2(linearVelocity);
+    auto dir = normalize(linearVelocity);
+    auto local_dir = rotate_inv(rotation, dir);
+    float area = dot(airframe.drag_area, abs(local_dir));
+    total_force = total_force - dir * (airframe.drag * vel2 * area);
+
+    // motors, all thrust is along the up axis:
+    float thrust = 0;
+    for (auto i = 0u; i < N; i++) {
+        thrust += motors[i].thrust;
     }
+    total_force = total_force + rotate(rotation, vec3{0, thrust, 0});
 
-    acceleration = total_force / init_packet.quad_mass.value;
-    state.linearVelocity.value = state.linearVelocity.value + acceleration * dt;
+    return total_force;
+}
 
-    assert(std::isfinite(length(state.linearVelocity.value)));
+template <unsigned N>
+vmath::vec3 Simulator::angular_acceleration(const vmath::quat& rotation,
+                                            const Motors& motors,
+                                            float motorsTorque) const {
+    using namespace vmath;
 
-    // moment sum around origin:
-    vec3 total_moment = get_axis(state.rotation.value, 1) * motorsTorque;
+    // Moment sum around the origin in the body frame, where the inertia
+    // tensor is diagonal, so only the result needs to be rotated.
+    vec3 total_moment = vec3{0, motorsTorque, 0};
 
-    for (auto i = 0u; i < 4; i++) {
-        auto force = xform(state.rotation.value, {0, motors[i].thrust, 0});
-        auto rad = xform(state.rotation.value, motors[i].position);
-        total_moment = total_moment + cross(rad, force);
+    for (auto i = 0u; i < N; i++) {
+        total_moment =
+          total_moment + cross(motors[i].position, {0, motors[i].thrust, 0});
     }
 
-    vec3 inv_inertia = init_packet.quad_inv_inertia.value;
-    mat3 inv_tensor = {vec3{inv_inertia[0], 0, 0},
-                       vec3{0, inv_inertia[1], 0},
-                       vec3{0, 0, inv_inertia[2]}};
-    inv_tensor =
-      state.rotation.value * inv_tensor * transpose(state.rotation.value);
-    vec3 angularAcc = xform(inv_tensor, total_moment);
+    vec3 angularAcc = rotate(rotation, airframe.inv_inertia * total_moment);
     assert(std::isfinite(angularAcc[0]) && std::isfinite(angularAcc[1]) &&
            std::isfinite(angularAcc[2]));
-    state.angularVelocity.value = state.angularVelocity.value + angularAcc * dt;
+    return angularAcc;
+}
+
+template <unsigned N>
+vmath::vec3 Simulator::calculate_physics(float dt,
+                                         Body& body,
+                                         const Motors& motors,
+                                         float motorsTorque) {
+    using namespace vmath;
+
+    const auto acceleration =
+      body_force<N>(body.rotation, body.linearVelocity, motors) *
+      airframe.inv_mass;
+    body.linearVelocity = body.linearVelocity + acceleration * dt;
 
-    update_rotation(dt, state);
+    assert(std::isfinite(length(body.linearVelocity)));
+
+    const auto angularAcc =
+      angular_acceleration<N>(body.rotation, motors, motorsTorque);
+    body.angularVelocity = body.angularVelocity + angularAcc * dt;
+
+    update_rotation(dt, body);
 
     return acceleration;
 }
 
+namespace {
+// What rk4_step integrates, and its derivative.
+template <unsigned N>
+struct Stage {
+    vmath::quat rotation;
+    vmath::vec3 angularVelocity;
+    vmath::vec3 linearVelocity;
+    std::array<float, N> rpm;
+};
+
+template <unsigned N>
+struct StageRate {
+    vmath::vec3 angularVelocity;
+    vmath::vec3 angularAcc;
+    vmath::vec3 acceleration;
+    std::array<float, N> rpm;
+};
+
+// stage + rate * dt, with the rotation on the exponential map.
+template <unsigned N>
+Stage<N> advance_stage(const Stage<N>& stage,
+                       const StageRate<N>& rate,
+                       float dt) {
+    using namespace vmath;
+    Stage<N> result;
+    result.rotation = quat_exp(rate.angularVelocity * dt) * stage.rotation;
+    result.angularVelocity = stage.angularVelocity + rate.angularAcc * dt;
+    result.linearVelocity = stage.linearVelocity + rate.acceleration * dt;
+    for (auto i = 0u; i < N; i++) {
+        result.rpm[i] = stage.rpm[i] + rate.rpm[i] * dt;
+    }
+    return result;
+}
+
+float max_abs(const vmath::vec3& v) {
+    return std::max({fabsf(v[0]), fabsf(v[1]), fabsf(v[2])});
+}
+}  // namespace
+
+template <unsigned N>
+vmath::vec3 Simulator::rk4_step(float dt,
+                                Body& body,
+                                Motors& motors,
+                                float& error) {
+    using namespace vmath;
+
+    std::array<float, N> volts;
+    for (auto i = 0u; i < N; i++) {
+        volts[i] = airframe.motor_volts(bf::motorsPwm[i]);
+    }
+
+    // Sets the thrust of the motors and returns the derivative of stage.
+    auto rate = [&](const Stage<N>& stage) {
+        const auto vel = prop_velocity(stage.rotation, stage.linearVelocity);
+
+        StageRate<N> result;
+        float motorsTorque = 0;
+        for (auto i = 0u; i < N; i++) {
+            const auto torque = airframe.motor_torque(volts[i], stage.rpm[i]);
+            result.rpm[i] = airframe.rpm_rate(torque, stage.rpm[i], vel);
+            motors[i].thrust = airframe.prop_thrust(stage.rpm[i], vel);
+            motorsTorque += airframe.motor_dir[i] * torque;
+        }
+
+        result.angularVelocity = stage.angularVelocity;
+        result.acceleration =
+          body_force<N>(stage.rotation, stage.linearVelocity, motors) *
+          airframe.inv_mass;
+        result.angularAcc =
+          angular_acceleration<N>(stage.rotation, motors, motorsTorque);
+        return result;
+    };
+
+    Stage<N> stage;
+    stage.rotation = body.rotation;
+    stage.angularVelocity = body.angularVelocity;
+    stage.linearVelocity = body.linearVelocity;
+    for (auto i = 0u; i < N; i++) {
+        stage.rpm[i] = motors[i].rpm;
+    }
+
+    const auto k1 = rate(stage);
+    const auto k2 = rate(advance_stage(stage, k1, dt / 2));
+    const auto k3 = rate(advance_stage(stage, k2, dt / 2));
+    const auto k4 = rate(advance_stage(stage, k3, dt));
+
+    StageRate<N> sum;
+    sum.angularVelocity = (k1.angularVelocity + 2 * k2.angularVelocity +
+                           2 * k3.angularVelocity + k4.angularVelocity) /
+                          6;
+    sum.angularAcc =
+      (k1.angularAcc + 2 * k2.angularAcc + 2 * k3.angularAcc + k4.angularAcc) /
+      6;
+    sum.acceleration = (k1.acceleration + 2 * k2.acceleration +
+                        2 * k3.acceleration + k4.acceleration) /
+                       6;
+    for (auto i = 0u; i < N; i++) {
+        sum.rpm[i] =
+          (k1.rpm[i] + 2 * k2.rpm[i] + 2 * k3.rpm[i] + k4.rpm[i]) / 6;
+    }
+
+    stage = advance_stage(stage, sum, dt);
+
+    // The Euler step is off by dt * (sum - k1), which is large when the
+    // derivatives change a lot over the step. RK4 is much closer than that.
+    error = std::max(max_abs((sum.angularAcc - k1.angularAcc) * dt),
+                     max_abs((sum.acceleration - k1.acceleration) * dt));
+    for (auto i = 0u; i < N; i++) {
+        error = std::max(error, fabsf(sum.rpm[i] - k1.rpm[i]) * dt / 1000);
+    }
+
+    body.rotation = normalize(stage.rotation);
+    body.angularVelocity = stage.angularVelocity;
+    body.linearVelocity = stage.linearVelocity;
+    assert(std::isfinite(length(body.linearVelocity)));
+
+    const auto vel = prop_velocity(body.rotation, body.linearVelocity);
+    for (auto i = 0u; i < N; i++) {
+        motors[i].rpm = stage.rpm[i];
+        motors[i].thrust = airframe.prop_thrust(stage.rpm[i], vel);
+    }
+
+    return k4.acceleration;
+}
+
+template <unsigned N>
+void Simulator::integrate(Body& body) {
+    const auto tick = tick_us / 1e6f;
+
+    while (pending_ticks > 0) {
+        const auto ticks = std::min(step_ticks, pending_ticks);
+
+        const auto saved = body;
+        const auto motors = motorsState;
+
+        float error;
+        const auto result = rk4_step<N>(ticks * tick, body, motorsState, error);
+
+        if (error > physics.tolerance && ticks > 1) {
+            body = saved;
+            motorsState = motors;
+            step_ticks = ticks / 2;
+            continue;
+        }
+
+        acceleration = result;
+        pending_ticks -= ticks;
+
+        // The error of the Euler step grows with dt^2.
+        const auto scale =
+          error > 0 ? 0.9f * std::sqrt(physics.tolerance / error) : 2.0f;
+        const auto next = std::round(ticks * vmath::clamp(scale, 0.5f, 2.0f));
+        step_ticks = std::clamp(uint32_t(next), 1u, physics.max_ticks);
+    }
+}
+
+template <unsigned N>
+void Simulator::physics_tick(float dt, Body& body) {
+    if (physics.integrator == Integrator::Rk4) {
+        pending_ticks += physics_ratio;
+        if (pending_ticks >= step_ticks) integrate<N>(body);
+        return;
+    }
+
+    float motorsTorque = calculate_motors<N>(dt, body, motorsState);
+
+    acceleration = calculate_physics<N>(dt, body, motorsState, motorsTorque);
+}
+
+template <unsigned... Counts>
+Simulator::PhysicsTick Simulator::physics_tick_for(
+  unsigned count,
+  std::integer_sequence<unsigned, Counts...>) {
+    const PhysicsTick ticks[] = {&Simulator::physics_tick<Counts + 1>...};
+    return ticks[count - 1];
+}
+
+// For the tests and benchmarks, which call them directly.
+#define INSTANTIATE_PHYSICS(N)                                             \
+    template float Simulator::calculate_motors<N>(                         \
+      float, const Body&, Motors&);                                        \
+    template vmath::vec3 Simulator::calculate_physics<N>(                  \
+      float, Body&, const Motors&, float);                                 \
+    template vmath::vec3 Simulator::rk4_step<N>(float, Body&, Motors&, float&);
+
+INSTANTIATE_PHYSICS(1)
+INSTANTIATE_PHYSICS(2)
+INSTANTIATE_PHYSICS(3)
+INSTANTIATE_PHYSICS(4)
+INSTANTIATE_PHYSICS(5)
+INSTANTIATE_PHYSICS(6)
+INSTANTIATE_PHYSICS(7)
+INSTANTIATE_PHYSICS(8)
+static_assert(MaxMotors == 8, "instantiate the physics for every count");
+
+#undef INSTANTIATE_PHYSICS
+
 void Simulator::set_rc_data(std::array<FloatT, 8> data) {
     std::array<uint16_t, 8> rcData;
     for (int i = 0; i < 8; i++) {
@@ -272,105 +589,527 @@ void Simulator::set_rc_data(std::array<FloatT, 8> data) {
     bf::rxMspFrameReceive(&rcData[0], 8);
 }
 
-Simulator::Simulator()
-    : recv_socket(kissnet::endpoint("localhost", 7777)),
-      send_socket(kissnet::endpoint("localhost", 6666)) {
-    recv_socket.bind();
+Simulator* Simulator::instance = nullptr;
+
+Simulator::Simulator(uint16_t recv_port,
+                     uint16_t send_port,
+                     uint16_t serial_port)
+    : Simulator(std::make_unique<UdpTransport>(recv_port, send_port),
+                serial_port) {
+}
+
+Simulator::Simulator(std::unique_ptr<Transport> transport,
+                     uint16_t serial_port)
+    : serial_port(serial_port), transport(std::move(transport)) {
+    assert(instance == nullptr && "Only one simulator per link namespace");
+    instance = this;
+}
+
+bool Simulator::set_rates(const Rates& new_rates) {
+    const auto& r = new_rates;
+    if (r.scheduler_hz == 0 || 1000000 % r.scheduler_hz != 0) return false;
+    if (r.physics_hz == 0 || r.scheduler_hz % r.physics_hz != 0) return false;
+    if (r.sensor_hz == 0 || r.scheduler_hz % r.sensor_hz != 0) return false;
+
+    rates = r;
+    tick_us = 1000000 / r.scheduler_hz;
+    physics_ratio = r.scheduler_hz / r.physics_hz;
+    sensor_ratio = r.scheduler_hz / r.sensor_hz;
+    return true;
+}
+
+const Simulator::Rates& Simulator::get_rates() const {
+    return rates;
+}
+
+bool Simulator::set_osd_canvas(uint32_t columns, uint32_t rows) {
+    if (columns == 0 || columns > MaxOsdColumns) return false;
+    if (rows == 0 || rows > MaxOsdRows) return false;
+
+    osd_columns = columns;
+    osd_rows = rows;
+    osd_delta = OsdDelta(columns, rows);
+    osd_keyframe = true;
+    return true;
+}
+
+uint64_t Simulator::next_task_due() const {
+    const auto now = uint32_t(micros_passed);
+
+    int32_t wait = INT32_MAX;
+    for (auto i = 0u; i < bf::TASK_COUNT; i++) {
+        bf::cfTaskInfo_t info;
+        bf::getTaskInfo(bf::cfTaskId_e(i), &info);
+        if (!info.isEnabled) continue;
+
+        // Tasks with a check function are event driven, but they are checked
+        // on every scheduler call anyway.
+        const auto& task = bf::cfTasks[i];
+        const auto due = task.lastExecutedAt + uint32_t(task.desiredPeriod);
+        wait = std::min(wait, int32_t(due - now));
+    }
+
+    return micros_passed + uint64_t(std::max(wait, 0));
 }
 
 Simulator& Simulator::getInstance() {
-    static Simulator simulator;
-    return simulator;
+    assert(instance != nullptr && "No simulator created");
+    return *instance;
 }
 
 Simulator::~Simulator() {
     dyad_shutdown();
+    instance = nullptr;
 }
 
-void Simulator::connect() {
+bool Simulator::connect() {
     fmt::print("Waiting for init packet\n");
 
-    init_packet = receive<InitPacket>(recv_socket);
+    BoolT t;
+    t.value = false;
+    while (!t.value) {
+        auto packet = receive_any<InitPacket>(*transport);
+        if (!packet) return false;
+        t.value = init(std::get<InitPacket>(*packet));
+        if (!t.value) {
+            fmt::print("Rejected init packet, sending false\n");
+            send(*transport, t);
+        }
+    }
+
+    fmt::print("Done, sending true\n\n");
+    send(*transport, t);
+    return true;
+}
 
-    for (auto i = 0u; i < 4; i++) {
+bool Simulator::init(const InitPacket& packet) {
+    // The count comes from the game, everything below indexes by it.
+    const auto motors = packet.motor_count.value;
+    if (motors < 1 || motors > int32_t(MaxMotors)) return false;
+
+    init_packet = packet;
+    airframe = Airframe(packet);
+    tick_physics = physics_tick_for(
+      airframe.motor_count, std::make_integer_sequence<unsigned, MaxMotors>());
+
+    for (auto i = 0u; i < airframe.motor_count; i++) {
         motorsState[i].position = init_packet.quad_motor_pos.value[i].value;
     }
 
+    const auto gyro_hz = sensors.get_timing(SensorPipeline::Gyro).rate_hz;
+    gyro_noise.configure(noise, packet, std::min(gyro_hz, rates.sensor_hz));
+
     fmt::print("Initializing dyad\n");
     dyad_init();
-    dyad_setUpdateTimeout(0.001);
 
     fmt::print("Initializing betaflight\n");
+    bf::tcpSetBasePort(serial_port);
+    bf::fakeDisplaySetCanvas(uint8_t(osd_columns), uint8_t(osd_rows));
     bf::init();
 
-    fmt::print("Done, sending true\n\n");
-    BoolT t;
-    t.value = true;
-    send_socket.send(reinterpret_cast<const std::byte*>(&t), sizeof(BoolT));
-}
-
-bool Simulator::step() {
-    auto stateOrStop = receive<StatePacket, true>(recv_socket);
-    if (!stateOrStop) {
-        return false;
+    // Before the snapshot, so restoring it keeps the wrappers.
+    if (task_profiler.is_enabled()) {
+        wrap_tasks(task_profiler,
+                   std::make_integer_sequence<unsigned, bf::TASK_COUNT>());
     }
-    auto state = *stateOrStop;
 
-    const auto deltaMicros = int(state.delta.value * 1e6);
-    total_delta += deltaMicros;
+    snapshot();
+    return true;
+}
 
-    // const auto last = hr_clock::now();
+void Simulator::update_serial(double timeout) {
+    if (!serial_enabled) return;
 
+    StepProfiler::Scope scope(profiler, StepProfiler::Dyad);
+    dyad_setUpdateTimeout(timeout);
     dyad_update();
+}
 
-    // auto dyad_time = hr_clock::now() - last;
-    // long long dyad_time_i = to_us(dyad_time);
+void Simulator::advance(StatePacket& state) {
+    update_serial(serial_timeout);
+    run_frame(state);
+}
+
+void Simulator::run_frame(StatePacket& state) {
+    const auto deltaMicros = int(state.delta.value * 1e6);
+    total_delta += deltaMicros;
+    frames++;
 
     // update rc at 100Hz, otherwise rx loss gets reported:
     set_rc_data(state.rcData.value);
 
-    for (auto k = 0u; total_delta - DELTA >= 0; k++) {
-        total_delta -= DELTA;
-        micros_passed += DELTA;
-        const float dt = DELTA / 1e6f;
+    const float dt = physics_ratio * tick_us / 1e6f;
+
+    // The new rc data and serial input may make a task due.
+    auto input_pending = true;
 
-        set_gyro(state, acceleration);
+    auto body = Body::from_state(state);
+
+    while (total_delta >= tick_us) {
+        total_delta -= tick_us;
+        micros_passed += tick_us;
+        const auto tick = micros_passed / tick_us;
+
+        const auto idle =
+          rates.skip_idle && !input_pending && micros_passed < next_task_us;
+
+        // When skipping idle ticks the sensors are sampled right before the
+        // scheduler runs, otherwise at their own rate.
+        const auto sample = rates.skip_idle ? !idle && sleep_timer <= 0
+                                            : tick % sensor_ratio == 0;
+        if (sample) {
+            StepProfiler::Scope scope(profiler, StepProfiler::Sensors);
+            update_sensors(state.position.value, body, acceleration);
+        }
 
         if (sleep_timer > 0) {
-            sleep_timer -= DELTA;
+            sleep_timer -= tick_us;
             sleep_timer = std::max(int64_t(0), sleep_timer);
-        } else {
+        } else if (!idle) {
+            StepProfiler::Scope scope(profiler, StepProfiler::Scheduler);
             bf::scheduler();
+            bf::tcpFlush();
+            scheduler_calls++;
+            input_pending = false;
+            if (rates.skip_idle) next_task_us = next_task_due();
         }
 
-        if (state.crashed.value) continue;
+        if (state.crashed.value || tick % physics_ratio != 0) continue;
+
+        StepProfiler::Scope scope(profiler, StepProfiler::Physics);
+
+        (this->*tick_physics)(dt, body);
+    }
+
+    body.to_state(state);
 
-        float motorsTorque = calculate_motors(dt, state, motorsState);
+    rollout.frames++;
+    rollout.angularVelocity = state.angularVelocity.value;
+    rollout.linearVelocity = state.linearVelocity.value;
+}
 
-        acceleration = calculate_physics(dt, state, motorsState, motorsTorque);
+void Simulator::copy_osd(uint8_t* osd) {
+    // Only the analog screen of a larger canvas fits.
+    for (auto y = 0u; y < OsdRows; y++) {
+        std::memcpy(osd + y * OsdColumns, bf::osdScreen[y], OsdColumns);
     }
+    // Whoever gets a whole screen has every row.
+    bf::osdDirtyRows = 0;
+    osd_keyframe = true;
+}
+
+void Simulator::send_osd_delta(const StatePacket& state) {
+    last_osd_time = micros_passed;
+    auto& update = osd_packet;
+    auto* cells = &update.cells.value[0];
 
-    if (micros_passed - last_osd_time > OSD_UPDATE_TIME) {
-        last_osd_time = micros_passed;
-        StateOsdUpdatePacket update;
+    std::optional<std::size_t> len;
+    if (!osd_keyframe && osd_updates % OSD_KEYFRAME_INTERVAL != 0) {
+        len = osd_delta.encode(
+          &bf::osdScreen[0][0], MaxOsdColumns, bf::osdDirtyRows, cells);
+    }
+    bf::osdDirtyRows = 0;
+    osd_updates++;
+
+    if (len && *len == 0) {
+        auto& plain = emplace<StateUpdatePacket>(*transport);
+        plain.angularVelocity.value = state.angularVelocity.value;
+        plain.linearVelocity.value = state.linearVelocity.value;
+        transport->commit();
+        return;
+    }
+
+    update.keyframe = !len;
+    if (!len) {
+        len = osd_delta.keyframe(&bf::osdScreen[0][0], MaxOsdColumns, cells);
+    }
+    osd_keyframe = false;
+
+    update.angularVelocity.value = state.angularVelocity.value;
+    update.linearVelocity.value = state.linearVelocity.value;
+    update.sequence = osd_sequence++;
+    update.columns = int32_t(osd_columns);
+    update.rows = int32_t(osd_rows);
+    update.cells._len = uint32_t(*len);
+    transport->send(reinterpret_cast<const std::byte*>(&update),
+                    send_size(update));
+}
+
+bool Simulator::osd_due() const {
+    return micros_passed - last_osd_time > OSD_UPDATE_TIME;
+}
+
+bool Simulator::update_osd(uint8_t* osd) {
+    if (!osd_due()) {
+        return false;
+    }
+
+    last_osd_time = micros_passed;
+    copy_osd(osd);
+    return true;
+}
+
+void Simulator::handle(StatePacket& state) {
+    advance(state);
+
+    StepProfiler::Scope scope(profiler, StepProfiler::Send);
+    if (osd_due() && osd_deltas) {
+        send_osd_delta(state);
+    } else if (osd_due()) {
+        auto& update = emplace<StateOsdUpdatePacket>(*transport);
         update.angularVelocity.value = state.angularVelocity.value;
         update.linearVelocity.value = state.linearVelocity.value;
-        for (int y = 0; y < VIDEO_LINES; y++) {
-            for (int x = 0; x < CHARS_PER_LINE; x++) {
-                update.osd.value[y * CHARS_PER_LINE + x] = bf::osdScreen[y][x];
-            }
-        }
-        send(send_socket, update);
+        update_osd(&update.osd.value[0]);
+        transport->commit();
     } else {
-        StateUpdatePacket update;
+        auto& update = emplace<StateUpdatePacket>(*transport);
         update.angularVelocity.value = state.angularVelocity.value;
         update.linearVelocity.value = state.linearVelocity.value;
-        send(send_socket, update);
+        transport->commit();
+    }
+}
+
+void Simulator::handle(BatchStatePacket& batch) {
+    using namespace vmath;
+
+    StatePacket state;
+    state.delta = batch.delta;
+    state.position = batch.position;
+    state.rotation = batch.rotation;
+    state.angularVelocity = batch.angularVelocity;
+    state.linearVelocity = batch.linearVelocity;
+    state.crashed = batch.crashed;
+
+    const auto frames =
+      std::clamp(batch.frames.value, 0, int32_t(MaxBatchFrames));
+
+    auto& update = emplace<BatchStateUpdatePacket>(*transport);
+    update.frames = frames;
+
+    // The game waits for the whole batch, don't sleep in dyad per frame.
+    update_serial(0);
+
+    for (auto k = 0; k < frames; k++) {
+        for (auto i = 0u; i < 8; i++) {
+            state.rcData.value[i] = batch.rcData.value[k * 8 + i];
+        }
+
+        run_frame(state);
+
+        // The game only integrates the position once per batch, move the
+        // quad in between so the gps follows.
+        state.position.value =
+          state.position.value + state.linearVelocity.value * state.delta.value;
+
+        update.angularVelocity.value[k] = state.angularVelocity;
+        update.linearVelocity.value[k] = state.linearVelocity;
+    }
+    // The packet is reserved in place, don't send what the buffer held.
+    for (auto k = frames; k < int32_t(MaxBatchFrames); k++) {
+        update.angularVelocity.value[k].value = {0, 0, 0};
+        update.linearVelocity.value[k].value = {0, 0, 0};
+    }
+
+    StepProfiler::Scope scope(profiler, StepProfiler::Send);
+    last_osd_time = micros_passed;
+    copy_osd(&update.osd.value[0]);
+    transport->commit();
+}
+
+void Simulator::handle(ControlPacket& control) {
+    BoolT result;
+    switch (Command(control.command.value)) {
+        case Command::Snapshot:
+            result = snapshot();
+            break;
+        case Command::Restore:
+            result = restore();
+            break;
+        case Command::OsdKeyframe:
+            osd_keyframe = true;
+            result = true;
+            break;
+        default:
+            result = false;
+            break;
+    }
+    send(*transport, result);
+}
+
+void Simulator::handle(ForkPacket& fork) {
+    ForkResultPacket result;
+    result.children = 0;
+
+#ifndef _WIN32
+    const auto children =
+      std::clamp(fork.children.value, 0, int32_t(MaxForkChildren));
+
+    // The ports of the children must not wrap onto unrelated ports.
+    const auto base_port = int64_t(fork.base_port.value);
+    if (base_port < 1024 || base_port + 2 * children - 1 > UINT16_MAX) {
+        send(*transport, result);
+        return;
+    }
+
+    // Bind the sockets of the children before forking, so the game can send
+    // to them as soon as it receives the result of the fork.
+    std::vector<std::unique_ptr<Transport>> transports;
+    for (auto i = 0; i < children; i++) {
+        const auto port = uint16_t(base_port + 2 * i);
+        transports.push_back(
+          std::make_unique<UdpTransport>(port, uint16_t(port + 1)));
     }
 
+    // The children must not send what the parent still has queued.
+    transport->flush();
+    std::fflush(nullptr);
+
+    std::vector<std::pair<pid_t, int>> forked;
+    for (auto i = 0; i < children; i++) {
+        int fds[2];
+        if (pipe(fds) != 0) break;
+
+        const auto pid = ::fork();
+        if (pid == 0) {
+            close(fds[0]);
+            for (const auto& child : forked) close(child.second);
+
+            // The child takes over the sockets of its rollout and leaves
+            // the serial ports to the parent. The transport to the game
+            // belongs to the parent too, destroying it here could close or
+            // unlink what the parent still uses.
+            transport.release();
+            transport = std::move(transports[i]);
+            transports.clear();
+            rollout = RolloutResult();
+            rollout_fd = fds[1];
+            serial_enabled = false;
+            return;
+        }
+
+        close(fds[1]);
+        if (pid < 0) {
+            close(fds[0]);
+            break;
+        }
+        forked.emplace_back(pid, fds[0]);
+    }
+
+    transports.clear();
+
+    for (auto i = 0u; i < forked.size(); i++) {
+        const auto [pid, fd] = forked[i];
+
+        RolloutResult child;
+        if (read(fd, &child, sizeof(child)) != sizeof(child)) {
+            child = RolloutResult();
+        }
+        close(fd);
+        waitpid(pid, nullptr, 0);
+
+        result.frames.value[i] = child.frames;
+        result.angularVelocity.value[i] = child.angularVelocity;
+        result.linearVelocity.value[i] = child.linearVelocity;
+    }
+    result.children = int32_t(forked.size());
+#endif
+
+    send(*transport, result);
+}
+
+void Simulator::finish_rollout() {
+#ifndef _WIN32
+    const auto written = write(rollout_fd, &rollout, sizeof(rollout));
+    (void)written;
+    close(rollout_fd);
+    std::fflush(nullptr);
+    _exit(0);
+#endif
+    std::abort();
+}
+
+bool Simulator::snapshot() {
+    saved.total_delta = total_delta;
+    saved.last_osd_time = last_osd_time;
+    saved.acceleration = acceleration;
+    saved.motorsState = motorsState;
+    saved.pending_ticks = pending_ticks;
+    saved.step_ticks = step_ticks;
+    saved.micros_passed = micros_passed;
+    saved.sleep_timer = sleep_timer;
+    saved.sensors = sensors.get_state();
+    saved.gyro_noise = gyro_noise.get_state();
+
+    saved.memory.clear();
+#ifdef __linux__
+    if (__betaflight_data_start != nullptr &&
+        __betaflight_bss_start != nullptr) {
+        saved.memory.add(__betaflight_data_start, __betaflight_data_end);
+        saved.memory.add(__betaflight_bss_start, __betaflight_bss_end);
+    }
+#endif
+    return !saved.memory.empty();
+}
+
+bool Simulator::restore() {
+    if (saved.memory.empty()) {
+        return false;
+    }
+
+    std::array<bf::tcpConnection_t, SERIAL_PORT_COUNT> connections;
+    bf::tcpGetConnections(&connections[0]);
+    saved.memory.restore();
+    bf::tcpSetConnections(&connections[0]);
+
+    total_delta = saved.total_delta;
+    last_osd_time = saved.last_osd_time;
+    acceleration = saved.acceleration;
+    motorsState = saved.motorsState;
+    pending_ticks = saved.pending_ticks;
+    step_ticks = saved.step_ticks;
+    next_task_us = 0;
+    micros_passed = saved.micros_passed;
+    sleep_timer = saved.sleep_timer;
+    sensors.set_state(saved.sensors);
+    // The game still shows the screen from before.
+    osd_keyframe = true;
+    gyro_noise.set_state(saved.gyro_noise);
+
     return true;
 }
 
+bool Simulator::handle_next() {
+    std::optional<
+      std::variant<StatePacket, BatchStatePacket, ControlPacket, ForkPacket>>
+      packet;
+    {
+        StepProfiler::Scope scope(profiler, StepProfiler::Receive);
+        packet =
+          receive_any<StatePacket, BatchStatePacket, ControlPacket, ForkPacket>(
+            *transport);
+    }
+
+    if (!packet) {
+        if (rollout_fd >= 0) finish_rollout();
+        return false;
+    }
+
+    std::visit([this](auto& p) { handle(p); }, *packet);
+
+    return true;
+}
+
+bool Simulator::step() {
+    bool running;
+    {
+        StepProfiler::Scope scope(profiler, StepProfiler::Frame);
+        running = handle_next();
+    }
+
+    profiler.end_frame();
+    return running;
+}
+
 /*********************
  * Betaflight Stuff: *
  *********************/
@@ -1,8 +1,17 @@
 #pragma once
 
+#include "airframe.h"
+#include "noise.h"
+#include "osd.h"
 #include "packets.h"
+#include "profiler.h"
+#include "sensors.h"
+#include "snapshot.h"
+#include "transport.h"
 
 #include <cstdint>
+#include <memory>
+#include <utility>
 
 class Simulator {
    public:
@@ -12,51 +21,292 @@ class Simulator {
         float thrust = 0;
     };
 
-   private:
+    /// Only the first Airframe::motor_count are used.
+    using Motors = std::array<MotorState, MaxMotors>;
+
+    /// The attitude and velocities the physics works on. The game sends the
+    /// rotation as a basis, advance() only converts it on the way in and
+    /// out.
+    struct Body {
+        vmath::quat rotation = vmath::quat_identity;
+        vmath::vec3 angularVelocity = {0, 0, 0};
+        vmath::vec3 linearVelocity = {0, 0, 0};
+
+        static Body from_state(const StatePacket& state);
+        void to_state(StatePacket& state) const;
+    };
+
+    enum class Integrator {
+        /// Euler steps of the velocities, then of the rotation with the new
+        /// angular velocity, every scheduler tick.
+        SemiImplicit,
+        /// RK4 steps of whole scheduler ticks, as long as the error allows.
+        /// The rotation is advanced with the exponential map.
+        Rk4
+    };
+
+    /// How often the parts of a tick run. The betaflight scheduler sets the
+    /// base rate, the other rates have to divide it. The default 20 kHz is
+    /// enough to run the PID loop at 8 kHz.
+    struct Rates {
+        uint32_t scheduler_hz = 20000;
+        uint32_t physics_hz = 20000;
+        uint32_t sensor_hz = 20000;
+        /// Only calls the scheduler on ticks where a betaflight task is due,
+        /// or new input arrived. The sensors are sampled right before.
+        bool skip_idle = false;
+    };
+
+    struct PhysicsOptions {
+        Integrator integrator = Integrator::SemiImplicit;
+        /// How far the velocities (m/s, rad/s) and the motor speeds (1000
+        /// rpm) of an RK4 step may deviate from an Euler step.
+        float tolerance = 1e-3f;
+        /// Longest RK4 step in scheduler ticks, at least 1.
+        uint32_t max_ticks = 20;
+    };
+
+   protected:
     InitPacket init_packet;
+    /// init_packet compiled for the physics.
+    Airframe airframe;
 
+   private:
     uint64_t total_delta = 0;
 
     uint64_t last_osd_time = 0;
+    uint32_t osd_columns = OsdColumns;
+    uint32_t osd_rows = OsdRows;
+    /// The OSD as the game has it, for delta updates.
+    OsdDelta osd_delta;
+    StateOsdDeltaPacket osd_packet;
+    int32_t osd_sequence = 0;
+    uint32_t osd_updates = 0;
+    /// Whether the game may not have the last screen, so the next delta
+    /// update has to be a keyframe.
+    bool osd_keyframe = true;
     vmath::vec3 acceleration = {0, 0, 0};
 
-    std::array<MotorState, 4> motorsState;
+    Motors motorsState;
+
+    /// Built from noise when the airframe is set up.
+    GyroNoise gyro_noise;
+
+    /// physics_tick for the motor count of the airframe.
+    using PhysicsTick = void (Simulator::*)(float dt, Body& body);
+    PhysicsTick tick_physics = nullptr;
+
+    Rates rates;
+    uint32_t tick_us = 50;
+    uint32_t physics_ratio = 1;
+    uint32_t sensor_ratio = 1;
+
+    /// With Rates::skip_idle, the scheduler has nothing to do before this.
+    uint64_t next_task_us = 0;
+    uint64_t next_task_due() const;
+
+    /// Scheduler ticks the RK4 integrator is behind and its step length.
+    uint32_t pending_ticks = 0;
+    uint32_t step_ticks = 1;
+
+    uint16_t serial_port;
+
+    std::unique_ptr<Transport> transport;
+
+    /// Everything restore() rewinds besides the betaflight memory.
+    struct Snapshot {
+        uint64_t total_delta = 0;
+        uint64_t last_osd_time = 0;
+        vmath::vec3 acceleration = {0, 0, 0};
+        Motors motorsState;
+        uint32_t pending_ticks = 0;
+        uint32_t step_ticks = 1;
+        uint64_t micros_passed = 0;
+        int64_t sleep_timer = 0;
+        SensorPipeline::State sensors;
+        GyroNoise::State gyro_noise;
+
+        MemorySnapshot memory;
+    };
+
+    Snapshot saved;
+
+    /// What a forked child reports back to its parent when it stops.
+    struct RolloutResult {
+        int32_t frames = 0;
+        vmath::vec3 angularVelocity = {0, 0, 0};
+        vmath::vec3 linearVelocity = {0, 0, 0};
+    };
+
+    RolloutResult rollout;
+
+    /// Pipe to the parent in a forked child, -1 otherwise.
+    int rollout_fd = -1;
+
+    static Simulator* instance;
 
-    kissnet::udp_socket recv_socket;
-    kissnet::udp_socket send_socket;
+    /// Copies the analog OSD screen, the next delta update is a keyframe.
+    void copy_osd(uint8_t* osd);
+    /// Sends the OSD cells that changed, or a StateUpdatePacket if none.
+    void send_osd_delta(const StatePacket& state);
+    bool osd_due() const;
 
-    static void update_rotation(float dt, StatePacket& state);
+    /// Hands serial traffic between dyad and betaflight, waiting up to
+    /// timeout seconds for some.
+    void update_serial(double timeout);
+    /// advance() without the serial ports.
+    void run_frame(StatePacket& state);
 
-    float motor_torque(float volts, float rpm);
-    float prop_thrust(float rpm, float vel);
-    float prop_torque(float rpm, float vel);
+    void handle(StatePacket& state);
+    void handle(BatchStatePacket& batch);
+    void handle(ControlPacket& control);
+    void handle(ForkPacket& fork);
+
+    [[noreturn]] void finish_rollout();
+
+    /// Receives and handles one packet, step() times it as one frame.
+    bool handle_next();
+
+    // The physics is specialized for the N motors of the airframe, so the
+    // loops over the motors unroll.
+
+    template <unsigned N>
+    vmath::vec3 body_force(const vmath::quat& rotation,
+                           const vmath::vec3& linearVelocity,
+                           const Motors& motors) const;
+    template <unsigned N>
+    vmath::vec3 angular_acceleration(const vmath::quat& rotation,
+                                     const Motors& motors,
+                                     float motorsTorque) const;
+
+    /// Catches the RK4 integrator up on the pending ticks.
+    template <unsigned N>
+    void integrate(Body& body);
+
+    /// Advances the physics by one physics tick of dt.
+    template <unsigned N>
+    void physics_tick(float dt, Body& body);
+
+    template <unsigned... Counts>
+    static PhysicsTick physics_tick_for(
+      unsigned count,
+      std::integer_sequence<unsigned, Counts...>);
 
     // protected for testing
    protected:
-    void set_gyro(const StatePacket& state, const vmath::vec3& acceleration);
+    /// Samples the sensors that are due and hands betaflight the samples
+    /// whose latency is over.
+    void update_sensors(const vmath::vec3& position,
+                        const Body& body,
+                        const vmath::vec3& acceleration);
+
+    static void update_rotation(float dt, Body& body);
 
-    float calculate_motors(float dt,
-                           const StatePacket& state,
-                           std::array<MotorState, 4>& motors);
+    /// Advances the motors and the body by dt in one RK4 step with the motor
+    /// voltages held. Returns the acceleration of the last stage, error is
+    /// set to the largest deviation from an Euler step, see PhysicsOptions.
+    template <unsigned N>
+    vmath::vec3 rk4_step(float dt, Body& body, Motors& motors, float& error);
 
+    template <unsigned N>
+    float calculate_motors(float dt, const Body& body, Motors& motors);
+
+    template <unsigned N>
     vmath::vec3 calculate_physics(float dt,
-                                  StatePacket& state,
-                                  const std::array<MotorState, 4>& motors,
+                                  Body& body,
+                                  const Motors& motors,
                                   float motorsTorque);
 
     void set_rc_data(std::array<FloatT, 8> data);
 
-    Simulator();
-
    public:
+    static constexpr uint16_t DEFAULT_RECV_PORT = 7777;
+    static constexpr uint16_t DEFAULT_SEND_PORT = 6666;
+    static constexpr uint16_t DEFAULT_SERIAL_PORT = 5760;
+
     uint64_t micros_passed = 0;
     int64_t sleep_timer = 0;
 
+    /// Game frames simulated, not rewound by restore().
+    uint64_t frames = 0;
+    /// Calls of the betaflight scheduler, not rewound by restore().
+    uint64_t scheduler_calls = 0;
+
+    PhysicsOptions physics;
+
+    /// Whether advance() polls the serial ports.
+    bool serial_enabled = true;
+    /// Seconds advance() waits for serial traffic, 0 only polls. Batches
+    /// poll once without waiting.
+    double serial_timeout = 0.001;
+
+    /// Sends the OSD as a StateOsdDeltaPacket with the cells that changed
+    /// instead of the whole screen.
+    bool osd_deltas = false;
+
+    /// Rates and latencies of the fake sensors.
+    SensorPipeline sensors;
+
+    /// Gyro noise and motor vibration, set it before connect() or init().
+    GyroNoise::Options noise;
+
+    /// Disabled by default, enable() it to time the phases of step().
+    StepProfiler profiler;
+
+    /// Times every betaflight task, enable() it before connect() or init().
+    TaskProfiler task_profiler;
+
+    /// Betaflight state is global, so there can only be one simulator per
+    /// link namespace. Use kwadSimMulti to host several in one process.
+    Simulator(uint16_t recv_port = DEFAULT_RECV_PORT,
+              uint16_t send_port = DEFAULT_SEND_PORT,
+              uint16_t serial_port = DEFAULT_SERIAL_PORT);
+
+    explicit Simulator(std::unique_ptr<Transport> transport,
+                       uint16_t serial_port = DEFAULT_SERIAL_PORT);
+
+    Simulator(const Simulator&) = delete;
+    Simulator& operator=(const Simulator&) = delete;
+
+    /// Returns the simulator driving the betaflight code in this namespace.
     static Simulator& getInstance();
 
     ~Simulator();
 
-    void connect();
+    /// Returns false and keeps the current rates unless the scheduler tick
+    /// is a whole number of microseconds and the other rates divide the
+    /// scheduler rate.
+    bool set_rates(const Rates& rates);
+    const Rates& get_rates() const;
 
+    /// Sets the OSD canvas size in characters before connect() or init(),
+    /// up to the MaxOsdColumns x MaxOsdRows of HD display ports. Only delta
+    /// updates carry more than the analog 30x16. Returns false and keeps
+    /// the canvas if it doesn't fit.
+    bool set_osd_canvas(uint32_t columns, uint32_t rows);
+
+    /// Receives the init packet from the game and initializes betaflight.
+    /// Init packets that init() rejects are answered with false. Returns
+    /// false if the transport ran out before an init packet.
+    bool connect();
+
+    /// Initializes betaflight without a game connection. Returns false and
+    /// leaves betaflight alone if the motor count is not 1 - MaxMotors.
+    bool init(const InitPacket& packet);
+
+    /// Receives and handles one packet, returns false on STOP.
     bool step();
+
+    /// Runs betaflight and the physics for one game frame.
+    void advance(StatePacket& state);
+
+    /// Copies the OSD screen if it is time for an OSD update.
+    bool update_osd(uint8_t* osd);
+
+    /// Saves the state of the simulator and all betaflight globals. connect()
+    /// takes the first snapshot right after initializing betaflight.
+    bool snapshot();
+
+    /// Rewinds to the last snapshot, serial connections are kept.
+    bool restore();
 };
\ No newline at end of file
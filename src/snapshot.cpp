@@ -0,0 +1,23 @@
+#include "snapshot.h"
+
+#include <cstring>
+
+void MemorySnapshot::add(void* start, void* end) {
+    auto* first = static_cast<std::byte*>(start);
+    auto* last = static_cast<std::byte*>(end);
+    regions.push_back({first, std::vector<std::byte>(first, last)});
+}
+
+void MemorySnapshot::clear() {
+    regions.clear();
+}
+
+void MemorySnapshot::restore() const {
+    for (const auto& region : regions) {
+        std::memcpy(region.start, region.data.data(), region.data.size());
+    }
+}
+
+bool MemorySnapshot::empty() const {
+    return regions.empty();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/// Copy of ranges of writable memory, e.g. the globals of betaflight.
+/// Restoring it rewinds everything in those ranges, so they must not hold
+/// objects that should survive a restore.
+class MemorySnapshot {
+    struct Region {
+        std::byte* start;
+        std::vector<std::byte> data;
+    };
+
+    std::vector<Region> regions;
+
+   public:
+    /// Captures the bytes from start up to end.
+    void add(void* start, void* end);
+
+    void clear();
+
+    void restore() const;
+
+    bool empty() const;
+};
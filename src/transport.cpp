@@ -0,0 +1,120 @@
+#include "transport.h"
+
+#include <cassert>
+
+namespace {
+void write_record(std::FILE* file, const std::byte* data, std::size_t len) {
+    const auto size = uint32_t(len);
+    std::fwrite(&size, sizeof(size), 1, file);
+    std::fwrite(data, 1, len, file);
+}
+}  // namespace
+
+std::byte* Transport::reserve(std::size_t len) {
+    if (send_buffer.size() < len) {
+        send_buffer.resize(len);
+    }
+    reserved = len;
+    return send_buffer.data();
+}
+
+void Transport::commit() {
+    send(send_buffer.data(), reserved);
+}
+
+UdpTransport::UdpTransport(uint16_t recv_port, uint16_t send_port)
+    : recv_socket(kissnet::endpoint("localhost", recv_port)),
+      send_socket(kissnet::endpoint("localhost", send_port)) {
+    recv_socket.bind();
+}
+
+std::optional<Transport::View> UdpTransport::recv() {
+    auto [len, no_error] = recv_socket.recv(buffer);
+    assert(no_error && "Error recv packet");
+    stats.syscalls++;
+    stats.received++;
+
+    return View{&buffer[0], len};
+}
+
+void UdpTransport::send(const std::byte* data, std::size_t len) {
+    auto [sent, no_error] = send_socket.send(data, len);
+    assert(no_error && "Error send");
+    assert(sent == len && "Error size send");
+    stats.syscalls++;
+    stats.sent++;
+}
+
+FileTransport::FileTransport(const char* in_path, const char* out_path)
+    : in_file(std::fopen(in_path, "rb")),
+      out_file(out_path ? std::fopen(out_path, "wb") : nullptr) {
+}
+
+FileTransport::~FileTransport() {
+    if (in_file) std::fclose(in_file);
+    if (out_file) std::fclose(out_file);
+}
+
+bool FileTransport::valid() const {
+    return in_file != nullptr;
+}
+
+std::optional<Transport::View> FileTransport::recv() {
+    uint32_t len;
+    if (std::fread(&len, sizeof(len), 1, in_file) != 1) {
+        return std::nullopt;
+    }
+
+    buffer.resize(len);
+    if (std::fread(buffer.data(), 1, len, in_file) != len) {
+        return std::nullopt;
+    }
+
+    return View{buffer.data(), len};
+}
+
+void FileTransport::send(const std::byte* data, std::size_t len) {
+    if (out_file) write_record(out_file, data, len);
+}
+
+RecordingTransport::RecordingTransport(std::unique_ptr<Transport> transport,
+                                       const char* path)
+    : transport(std::move(transport)), trace_file(std::fopen(path, "wb")) {
+}
+
+RecordingTransport::~RecordingTransport() {
+    if (trace_file) std::fclose(trace_file);
+}
+
+bool RecordingTransport::valid() const {
+    return trace_file != nullptr;
+}
+
+std::optional<Transport::View> RecordingTransport::recv() {
+    auto view = transport->recv();
+    if (view) {
+        auto [data, len] = *view;
+        write_record(trace_file, data, len);
+    }
+    return view;
+}
+
+void RecordingTransport::send(const std::byte* data, std::size_t len) {
+    transport->send(data, len);
+}
+
+std::byte* RecordingTransport::reserve(std::size_t len) {
+    return transport->reserve(len);
+}
+
+void RecordingTransport::commit() {
+    transport->commit();
+}
+
+void RecordingTransport::flush() {
+    transport->flush();
+}
+
+Transport::Counters RecordingTransport::counters() const {
+    return transport->counters();
+}
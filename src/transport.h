@@ -0,0 +1,152 @@
+#pragma once
+
+#include "packets.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+#include <kissnet.hpp>
+
+/// Moves raw packets between the simulator and the game.
+class Transport {
+    std::vector<std::byte> send_buffer;
+    std::size_t reserved = 0;
+
+   public:
+    using View = std::tuple<std::byte*, std::size_t>;
+
+    /// Work done by the transport, to compare the cost per frame.
+    struct Counters {
+        uint64_t syscalls = 0;
+        uint64_t received = 0;
+        uint64_t sent = 0;
+    };
+
+    virtual ~Transport() = default;
+
+    /// Blocks until a packet arrives. The data stays valid until the next
+    /// call, returns nullopt if no more packets will arrive.
+    virtual std::optional<View> recv() = 0;
+
+    virtual void send(const std::byte* data, std::size_t len) = 0;
+
+    /// Returns room for a packet of len bytes that the next commit() sends,
+    /// so packets can be encoded in place instead of copied. By default
+    /// this is a buffer that is reused for every packet.
+    virtual std::byte* reserve(std::size_t len);
+    virtual void commit();
+
+    /// Sends packets that the transport holds back, if any.
+    virtual void flush() {
+    }
+
+    virtual Counters counters() const {
+        return stats;
+    }
+
+   protected:
+    Counters stats;
+};
+
+/// For simulators that are driven in-process, never receives anything.
+class NullTransport : public Transport {
+   public:
+    std::optional<View> recv() override {
+        return std::nullopt;
+    }
+
+    void send(const std::byte*, std::size_t) override {
+    }
+};
+
+/// Two UDP sockets on localhost, the default link with the game.
+class UdpTransport : public Transport {
+    static constexpr std::size_t MaxDatagramSize = 65536;
+
+    kissnet::udp_socket recv_socket;
+    kissnet::udp_socket send_socket;
+
+    std::array<std::byte, MaxDatagramSize> buffer;
+
+   public:
+    UdpTransport(uint16_t recv_port, uint16_t send_port);
+
+    std::optional<View> recv() override;
+    void send(const std::byte* data, std::size_t len) override;
+};
+
+/// Reads packets from a trace file and writes responses to another one.
+/// Both files are a sequence of records: a uint32_t length and the packet.
+class FileTransport : public Transport {
+    std::FILE* in_file;
+    std::FILE* out_file;
+
+    std::vector<std::byte> buffer;
+
+   public:
+    /// out_path may be null to drop all responses.
+    FileTransport(const char* in_path, const char* out_path);
+    ~FileTransport() override;
+
+    bool valid() const;
+
+    std::optional<View> recv() override;
+    void send(const std::byte* data, std::size_t len) override;
+};
+
+/// Writes every packet received by another transport to a trace file that
+/// FileTransport can replay.
+class RecordingTransport : public Transport {
+    std::unique_ptr<Transport> transport;
+    std::FILE* trace_file;
+
+   public:
+    RecordingTransport(std::unique_ptr<Transport> transport, const char* path);
+    ~RecordingTransport() override;
+
+    bool valid() const;
+
+    std::optional<View> recv() override;
+    void send(const std::byte* data, std::size_t len) override;
+    std::byte* reserve(std::size_t len) override;
+    void commit() override;
+    void flush() override;
+    Counters counters() const override;
+};
+
+template <typename T>
+void send(Transport& transport, const T& packet) {
+    transport.send(reinterpret_cast<const std::byte*>(&packet), sizeof(T));
+}
+
+/// Constructs a packet in the send buffer of the transport, fill it in and
+/// call transport.commit() to send it.
+template <typename T>
+T& emplace(Transport& transport) {
+    static_assert(sizeof(T) == T::WireSize);
+    return *new (transport.reserve(sizeof(T))) T;
+}
+
+/// Receives one of the packets in Ts, returns nullopt on STOP or when the
+/// transport is closed.
+template <typename... Ts>
+std::optional<std::variant<Ts...>> receive_any(Transport& transport) {
+    auto view = transport.recv();
+    if (!view) {
+        return std::nullopt;
+    }
+
+    auto [data, len] = *view;
+    if (is_stop(data, len)) {
+        return std::nullopt;
+    }
+
+    auto result = get_any<Ts...>(data, len);
+    assert(result && "failed to parse received packet");
+    return result;
+}
@@ -132,6 +132,80 @@ inline mat3 operator*(const mat3& a, const mat3& b) {
                  dot(get_axis(b, 2), a[2])}};
 }
 
+// Quaternions are stored as {x, y, z, w}, the same order mat3_to_quat uses.
+
+constexpr quat quat_identity = {0, 0, 0, 1};
+
+/// Hamilton product, the rotation b followed by a.
+inline quat operator*(const quat& a, const quat& b) {
+    return {a[3] * b[0] + a[0] * b[3] + a[1] * b[2] - a[2] * b[1],
+            a[3] * b[1] - a[0] * b[2] + a[1] * b[3] + a[2] * b[0],
+            a[3] * b[2] + a[0] * b[1] - a[1] * b[0] + a[2] * b[3],
+            a[3] * b[3] - a[0] * b[0] - a[1] * b[1] - a[2] * b[2]};
+}
+
+inline quat conjugate(const quat& q) {
+    return {-q[0], -q[1], -q[2], q[3]};
+}
+
+inline quat normalize(const quat& q) {
+    const auto l2 = q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3];
+    const auto s = 1 / std::sqrt(l2);
+    return {q[0] * s, q[1] * s, q[2] * s, q[3] * s};
+}
+
+/// Rotates v by the unit quaternion q, the same as xform with
+/// quat_to_mat3(q) but without building the matrix.
+inline vec3 rotate(const quat& q, const vec3& v) {
+    const vec3 u = {q[0], q[1], q[2]};
+    const auto t = cross(u, v) * 2;
+    return v + t * q[3] + cross(u, t);
+}
+
+/// Rotates v by the inverse of the unit quaternion q, like xform_inv.
+inline vec3 rotate_inv(const quat& q, const vec3& v) {
+    return rotate(conjugate(q), v);
+}
+
+inline mat3 quat_to_mat3(const quat& q) {
+    const auto x = q[0], y = q[1], z = q[2], w = q[3];
+    return {vec3{1 - 2 * (y * y + z * z), 2 * (x * y - w * z),
+                 2 * (x * z + w * y)},
+            vec3{2 * (x * y + w * z), 1 - 2 * (x * x + z * z),
+                 2 * (y * z - w * x)},
+            vec3{2 * (x * z - w * y), 2 * (y * z + w * x),
+                 1 - 2 * (x * x + y * y)}};
+}
+
+/// Rotation by the length of v in radians around v, as a unit quaternion.
+inline quat quat_exp(const vec3& v) {
+    const auto angle2 = length2(v);
+
+    // sin(x/2)/x and cos(x/2), from their Taylor series near zero.
+    float a, w;
+    if (angle2 < 1e-6f) {
+        a = 0.5f - angle2 / 48;
+        w = 1 - angle2 / 8;
+    } else {
+        const auto angle = std::sqrt(angle2);
+        a = std::sin(angle / 2) / angle;
+        w = std::cos(angle / 2);
+    }
+
+    return {v[0] * a, v[1] * a, v[2] * a, w};
+}
+
+/// Advances q by the world space angular velocity w for dt with a first
+/// order step, renormalized.
+inline quat integrate(const quat& q, const vec3& w, float dt) {
+    const auto h = dt / 2;
+    const auto dq = quat{w[0], w[1], w[2], 0} * q;
+    return normalize(quat{q[0] + dq[0] * h,
+                          q[1] + dq[1] * h,
+                          q[2] + dq[2] * h,
+                          q[3] + dq[3] * h});
+}
+
 inline float clamp(float x, float min, float max) {
     if (x < min) return min;
     if (x > max) return max;
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "packets.h"
+
+/// A 5 inch quad, the airframe of the physics tests and benchmarks.
+inline InitPacket quad_airframe() {
+    using vmath::vec3;
+
+    InitPacket init_packet;
+    init_packet.motor_kv = 2600;
+    init_packet.motor_R = 0.1f;
+    init_packet.motor_I0 = 0.5f;
+
+    init_packet.prop_max_rpm = 36000;
+    init_packet.prop_a_factor = 7e-10f;
+    init_packet.prop_torque_factor = 0.0195f;
+    init_packet.prop_inertia = 3.5e-7f;
+    init_packet.prop_thrust_factors.value[0] = -0.00016f;
+    init_packet.prop_thrust_factors.value[1] = -0.002f;
+    init_packet.prop_thrust_factors.value[2] = 4.5f;
+
+    init_packet.frame_drag_area = vec3{0.008f, 0.02f, 0.008f};
+    init_packet.frame_drag_constant = 1.45f;
+
+    init_packet.quad_mass = 0.4f;
+    init_packet.quad_inv_inertia.value = vec3{300, 250, 300};
+    init_packet.quad_vbat = 16.0f;
+    init_packet.quad_motor_pos.value[0] = vec3{0.1f, 0, 0.1f};
+    init_packet.quad_motor_pos.value[1] = vec3{0.1f, 0, -0.1f};
+    init_packet.quad_motor_pos.value[2] = vec3{-0.1f, 0, 0.1f};
+    init_packet.quad_motor_pos.value[3] = vec3{-0.1f, 0, -0.1f};
+    init_packet.motor_count = 4;
+    init_packet.motor_dir.value[0] = 1.0f;
+    init_packet.motor_dir.value[1] = -1.0f;
+    init_packet.motor_dir.value[2] = -1.0f;
+    init_packet.motor_dir.value[3] = 1.0f;
+    return init_packet;
+}
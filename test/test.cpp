@@ -7,6 +7,10 @@
 
 #include <thread>
 
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
 namespace kn = kissnet;
 
 namespace {
@@ -23,7 +27,8 @@ using namespace vmath;
 TEST_CASE("Simulator init", "[simulator]") {
     auto [send_socket, recv_socket] = createSockets();
 
-    auto& simulator = Simulator::getInstance();
+    Simulator simulator;
+    REQUIRE(&Simulator::getInstance() == &simulator);
     REQUIRE(simulator.micros_passed == 0);
 
     InitPacket init_packet;
@@ -49,9 +54,14 @@ TEST_CASE("Simulator init", "[simulator]") {
     init_packet.quad_motor_pos.value[1] = vec3{1, 0, -1};
     init_packet.quad_motor_pos.value[2] = vec3{-1, 0, 1};
     init_packet.quad_motor_pos.value[3] = vec3{-1, 0, -1};
+    init_packet.motor_count = 4;
+    init_packet.motor_dir.value[0] = 1.0f;
+    init_packet.motor_dir.value[1] = -1.0f;
+    init_packet.motor_dir.value[2] = -1.0f;
+    init_packet.motor_dir.value[3] = 1.0f;
 
     send(send_socket, init_packet);
-    simulator.connect();
+    REQUIRE(simulator.connect());
 
     REQUIRE(receive<BoolT>(recv_socket));
 
@@ -101,6 +111,68 @@ TEST_CASE("Simulator init", "[simulator]") {
         receive<StateOsdUpdatePacket, false, true>(recv_socket);
     }
 
+    BatchStatePacket batch;
+    batch.delta = 0.01f;
+    batch.position = vec3{0, 0, 0};
+    batch.rotation.value = identity;
+    batch.angularVelocity = vec3{0, 0, 0};
+    batch.linearVelocity = vec3{0, 0, 0};
+    batch.crashed = false;
+    batch.frames = 4;
+
+    const auto batch_start = simulator.micros_passed;
+    send(send_socket, batch);
+    REQUIRE(simulator.step());
+    REQUIRE(simulator.micros_passed - batch_start == 40000);
+
+    auto batch_update = receive<BatchStateUpdatePacket>(recv_socket);
+    REQUIRE(batch_update.frames.value == 4);
+    REQUIRE(batch_update.linearVelocity.value[3].value[1] <
+            batch_update.linearVelocity.value[0].value[1]);
+
+#ifdef __linux__
+    ControlPacket control;
+    control.command = int32_t(Command::Snapshot);
+    send(send_socket, control);
+    REQUIRE(simulator.step());
+    REQUIRE(receive<BoolT>(recv_socket));
+    const auto snapshot_micros = simulator.micros_passed;
+
+    send(send_socket, state);
+    REQUIRE(simulator.step());
+    receive<StateOsdUpdatePacket, false, true>(recv_socket);
+    REQUIRE(simulator.micros_passed > snapshot_micros);
+
+    control.command = int32_t(Command::Restore);
+    send(send_socket, control);
+    REQUIRE(simulator.step());
+    REQUIRE(receive<BoolT>(recv_socket));
+    REQUIRE(simulator.micros_passed == snapshot_micros);
+
+    ForkPacket fork;
+    fork.children = 1;
+    fork.base_port = 80;
+    send(send_socket, fork);
+    REQUIRE(simulator.step());
+    REQUIRE(receive<ForkResultPacket>(recv_socket).children.value == 0);
+
+    const auto parent = getpid();
+    fork.base_port = 9000;
+    send(send_socket, fork);
+    REQUIRE(simulator.step());
+    if (getpid() != parent) {
+        // The child stops its rollout right away, which reports to the
+        // parent and exits.
+        kn::udp_socket stop_socket(kn::endpoint("localhost", 9000));
+        stop_socket.send(reinterpret_cast<const std::byte*>("STOP"), 4);
+        simulator.step();
+    }
+    const auto fork_result = receive<ForkResultPacket>(recv_socket);
+    REQUIRE(fork_result.children.value == 1);
+    REQUIRE(fork_result.frames.value[0].value == 0);
+    REQUIRE(simulator.micros_passed == snapshot_micros);
+#endif
+
     std::cout << "done running.." << std::endl;
 
     REQUIRE(simulator.micros_passed / 1000000 == 2);
@@ -109,4 +181,29 @@ TEST_CASE("Simulator init", "[simulator]") {
     REQUIRE_FALSE(simulator.step());
 
     serial_thread.join();
-}
\ No newline at end of file
+}
+
+TEST_CASE("Simulator rates", "[simulator]") {
+    Simulator simulator(std::make_unique<NullTransport>());
+
+    REQUIRE(simulator.get_rates().scheduler_hz == 20000);
+    REQUIRE(simulator.set_rates({8000, 2000, 8000}));
+    REQUIRE(simulator.get_rates().physics_hz == 2000);
+
+    // Not a whole number of microseconds per tick.
+    REQUIRE_FALSE(simulator.set_rates({16000, 8000, 8000}));
+    // Physics and sensors have to run on scheduler ticks.
+    REQUIRE_FALSE(simulator.set_rates({20000, 3000, 20000}));
+    REQUIRE_FALSE(simulator.set_rates({20000, 20000, 0}));
+    REQUIRE(simulator.get_rates().scheduler_hz == 8000);
+}
+
+TEST_CASE("Simulator rejects bad motor counts", "[simulator]") {
+    Simulator simulator(std::make_unique<NullTransport>());
+
+    InitPacket init_packet;
+    init_packet.motor_count = 0;
+    REQUIRE_FALSE(simulator.init(init_packet));
+    init_packet.motor_count = int32_t(MaxMotors) + 1;
+    REQUIRE_FALSE(simulator.init(init_packet));
+}
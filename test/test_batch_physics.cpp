@@ -0,0 +1,191 @@
+#include "catch.hpp"
+
+#include "airframes.h"
+#include "batch_physics.h"
+#include "simulator.h"
+
+extern "C" int16_t motorsPwm[];
+
+using namespace vmath;
+
+namespace {
+class ScalarSimulator : public Simulator {
+   public:
+    explicit ScalarSimulator(const InitPacket& init)
+        : Simulator(std::make_unique<NullTransport>()) {
+        init_packet = init;
+        airframe = Airframe(init);
+    }
+
+    using Simulator::calculate_motors;
+    using Simulator::calculate_physics;
+    using Simulator::rk4_step;
+};
+}  // namespace
+
+TEST_CASE("batch physics matches scalar physics", "[physics]") {
+    const auto init_packet = quad_airframe();
+
+    StatePacket state;
+    state.rotation.value = identity;
+    state.angularVelocity = vec3{0.1f, 0.2f, 0.0f};
+    state.linearVelocity = vec3{1.0f, 2.0f, 3.0f};
+
+    const std::array<float, 4> pwm = {300, 400, 500, 600};
+
+    ScalarSimulator simulator(init_packet);
+    Simulator::Motors motors;
+    for (auto i = 0u; i < 4; i++) {
+        motors[i].position = init_packet.quad_motor_pos.value[i].value;
+        motorsPwm[i] = int16_t(pwm[i]);
+    }
+
+    // Not a multiple of the simd width, so the last block is partial:
+    BatchPhysics physics(init_packet, simd::width + 1);
+    REQUIRE(physics.size() == simd::width + 1);
+    for (auto i = 0u; i < physics.size(); i++) {
+        physics.set_state(i, state);
+        physics.set_motors(i, pwm);
+    }
+
+    auto body = Simulator::Body::from_state(state);
+    const auto dt = 50e-6f;
+    for (auto k = 0; k < 2000; k++) {
+        const auto torque = simulator.calculate_motors<4>(dt, body, motors);
+        simulator.calculate_physics<4>(dt, body, motors, torque);
+        physics.step(dt);
+    }
+    body.to_state(state);
+
+    for (auto i = 0u; i < physics.size(); i++) {
+        const auto linear = physics.linear_velocity(i);
+        const auto angular = physics.angular_velocity(i);
+        for (auto j = 0u; j < 3; j++) {
+            REQUIRE(linear[j] ==
+                    Approx(state.linearVelocity.value[j]).epsilon(1e-3));
+            REQUIRE(angular[j] ==
+                    Approx(state.angularVelocity.value[j]).epsilon(1e-3));
+        }
+        REQUIRE(physics.rpm(i, 0) == Approx(motors[0].rpm).epsilon(1e-3));
+    }
+}
+
+TEST_CASE("rk4 matches small euler steps", "[physics]") {
+    const auto init_packet = quad_airframe();
+
+    StatePacket state;
+    state.rotation.value = identity;
+    state.angularVelocity = vec3{0.1f, 0.2f, 0.0f};
+    state.linearVelocity = vec3{1.0f, 2.0f, 3.0f};
+
+    ScalarSimulator simulator(init_packet);
+    Simulator::Motors motors;
+    for (auto i = 0u; i < 4; i++) {
+        motors[i].position = init_packet.quad_motor_pos.value[i].value;
+        motorsPwm[i] = int16_t(300 + i * 100);
+    }
+
+    auto body = Simulator::Body::from_state(state);
+    auto euler_body = body;
+    auto euler_motors = motors;
+    const auto euler_dt = 5e-6f;
+    for (auto k = 0; k < 20000; k++) {
+        const auto torque =
+          simulator.calculate_motors<4>(euler_dt, euler_body, euler_motors);
+        simulator.calculate_physics<4>(
+          euler_dt, euler_body, euler_motors, torque);
+    }
+
+    // 200 times longer steps.
+    float error;
+    for (auto k = 0; k < 100; k++) {
+        simulator.rk4_step<4>(1e-3f, body, motors, error);
+    }
+
+    for (auto j = 0u; j < 3; j++) {
+        REQUIRE(body.linearVelocity[j] ==
+                Approx(euler_body.linearVelocity[j]).epsilon(1e-2));
+        REQUIRE(body.angularVelocity[j] ==
+                Approx(euler_body.angularVelocity[j]).epsilon(1e-2));
+    }
+    for (auto i = 0u; i < 4; i++) {
+        REQUIRE(motors[i].rpm == Approx(euler_motors[i].rpm).epsilon(1e-3));
+        REQUIRE(body.rotation[i] ==
+                Approx(euler_body.rotation[i]).margin(1e-3));
+    }
+
+    // The rotation only goes back to a basis at the packet boundary, which
+    // has to stay orthonormal.
+    body.to_state(state);
+    const auto product = state.rotation.value * transpose(state.rotation.value);
+    for (auto i = 0u; i < 3; i++) {
+        for (auto j = 0u; j < 3; j++) {
+            REQUIRE(product[i][j] == Approx(identity[i][j]).margin(1e-5));
+        }
+    }
+}
+
+TEST_CASE("hexacopter hovers level", "[physics]") {
+    auto init_packet = quad_airframe();
+    init_packet.motor_count = 6;
+    for (auto i = 0u; i < 6; i++) {
+        const auto angle = float(i) * float(M_PI) / 3;
+        init_packet.quad_motor_pos.value[i] =
+          vec3{0.15f * std::cos(angle), 0, 0.15f * std::sin(angle)};
+        init_packet.motor_dir.value[i] = i % 2 ? -1.0f : 1.0f;
+    }
+
+    ScalarSimulator simulator(init_packet);
+    Simulator::Motors motors;
+    for (auto i = 0u; i < 6; i++) {
+        motors[i].position = init_packet.quad_motor_pos.value[i].value;
+        motorsPwm[i] = 500;
+    }
+
+    Simulator::Body body;
+    const auto dt = 50e-6f;
+    for (auto k = 0; k < 2000; k++) {
+        const auto torque = simulator.calculate_motors<6>(dt, body, motors);
+        simulator.calculate_physics<6>(dt, body, motors, torque);
+    }
+
+    // The moments of opposite motors and the torques of neighbours cancel.
+    for (auto j = 0u; j < 3; j++) {
+        REQUIRE(body.angularVelocity[j] == Approx(0).margin(1e-4));
+    }
+    REQUIRE(body.linearVelocity[1] > 0);
+    for (auto i = 1u; i < 6; i++) {
+        REQUIRE(motors[i].rpm == Approx(motors[0].rpm));
+    }
+}
+
+TEST_CASE("airframe precomputes the motor model", "[physics]") {
+    const auto init_packet = quad_airframe();
+    const Airframe model(init_packet);
+
+    const auto kv = init_packet.motor_kv.value;
+    const auto R = init_packet.motor_R.value;
+    const auto I0 = init_packet.motor_I0.value;
+    const auto volts = 400 / 1000.0f * init_packet.quad_vbat.value;
+    REQUIRE(model.motor_volts(400) == Approx(volts));
+
+    for (const auto rpm : {0.0f, 10000.0f, 30000.0f, 40000.0f}) {
+        auto current = (volts - rpm / kv) / R;
+        if (current > 0)
+            current = std::max(0.0f, current - I0);
+        else
+            current = std::min(0.0f, current + I0);
+        REQUIRE(model.motor_torque(volts, rpm) ==
+                Approx(current * 60 / (kv * 2 * float(M_PI))));
+
+        const auto vel = 5.0f;
+        const auto& factors = init_packet.prop_thrust_factors.value;
+        const auto propF = factors[0].value * vel * vel +
+                           factors[1].value * vel + factors[2].value;
+        const auto max_rpm = init_packet.prop_max_rpm.value;
+        const auto a = init_packet.prop_a_factor.value;
+        const auto b = (propF - a * max_rpm * max_rpm) / max_rpm;
+        REQUIRE(model.prop_thrust(rpm, vel) ==
+                Approx(std::max(0.0f, b * rpm + a * rpm * rpm)).margin(1e-6));
+    }
+}
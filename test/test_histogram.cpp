@@ -0,0 +1,75 @@
+#include "catch.hpp"
+
+#include "histogram.h"
+#include "profiler.h"
+
+#include <string>
+
+TEST_CASE("histogram", "[histogram]") {
+    Histogram histogram;
+    REQUIRE(histogram.count() == 0);
+    REQUIRE(histogram.percentile(0.5) == 0);
+
+    for (uint64_t i = 1; i <= 1000; i++) {
+        histogram.record(i);
+    }
+
+    REQUIRE(histogram.count() == 1000);
+    REQUIRE(histogram.max() == 1000);
+
+    // Buckets are a quarter of a power of two wide.
+    REQUIRE(histogram.percentile(0.5) >= 500);
+    REQUIRE(histogram.percentile(0.5) < 500 * 5 / 4);
+    REQUIRE(histogram.percentile(0.99) >= 990);
+    REQUIRE(histogram.percentile(0.99) <= 1000);
+
+    histogram.clear();
+    histogram.record(3);
+    REQUIRE(histogram.percentile(0.99) == 3);
+}
+
+TEST_CASE("step profiler", "[histogram]") {
+    StepProfiler profiler;
+
+    {
+        StepProfiler::Scope scope(profiler, StepProfiler::Physics);
+    }
+    profiler.end_frame();
+    REQUIRE(profiler.phase(StepProfiler::Physics).count() == 0);
+
+    profiler.enable(true);
+    for (auto i = 0; i < 3; i++) {
+        StepProfiler::Scope frame(profiler, StepProfiler::Frame);
+        StepProfiler::Scope first(profiler, StepProfiler::Physics);
+        StepProfiler::Scope second(profiler, StepProfiler::Physics);
+    }
+    profiler.end_frame();
+
+    // Scopes of the same phase add up within a frame.
+    REQUIRE(profiler.phase(StepProfiler::Physics).count() == 1);
+    REQUIRE(profiler.phase(StepProfiler::Frame).count() == 1);
+    REQUIRE(profiler.phase(StepProfiler::Send).max() == 0);
+
+    profiler.clear();
+    REQUIRE(profiler.phase(StepProfiler::Frame).count() == 0);
+}
+
+TEST_CASE("task profiler", "[histogram]") {
+    TaskProfiler profiler;
+    profiler.add("gyro");
+    profiler.add("osd");
+
+    profiler.record(1, 300, 0);
+    profiler.record(1, 100, 50);
+
+    const auto& osd = profiler.get_tasks()[1];
+    REQUIRE(osd.count == 2);
+    REQUIRE(osd.host_ns == 400);
+    REQUIRE(osd.max_host_ns == 300);
+    REQUIRE(osd.sim_us == 50);
+    REQUIRE(profiler.get_tasks()[0].count == 0);
+
+    profiler.clear();
+    REQUIRE(osd.count == 0);
+    REQUIRE(std::string(osd.name) == "osd");
+}
@@ -0,0 +1,80 @@
+#include "catch.hpp"
+
+#include "airframes.h"
+#include "noise.h"
+
+#include <cmath>
+
+using namespace vmath;
+
+TEST_CASE("gyro noise is shaped", "[noise]") {
+    GyroNoise::Options options;
+    options.noise_dps = 2;
+    options.noise_cutoff_hz = 200;
+
+    GyroNoise noise;
+    noise.configure(options, quad_airframe(), 20000);
+    REQUIRE(noise.enabled());
+
+    // Over a few laps of the ring.
+    const std::array<float, MaxMotors> rpm{};
+    const auto count = 4 * GyroNoise::RingSize;
+    vec3 sum2 = {0, 0, 0};
+    vec3 lag1 = {0, 0, 0};
+    vec3 last = {0, 0, 0};
+    for (auto i = 0u; i < count; i++) {
+        const auto n = noise.sample(i * 50, rpm);
+        for (auto j = 0u; j < 3; j++) {
+            sum2[j] += n[j] * n[j];
+            lag1[j] += n[j] * last[j];
+        }
+        last = n;
+    }
+
+    for (auto j = 0u; j < 3; j++) {
+        REQUIRE(std::sqrt(sum2[j] / count) == Approx(2).epsilon(0.05));
+        // White noise would not be correlated from one sample to the next.
+        REQUIRE(lag1[j] / sum2[j] > 0.9f);
+    }
+
+    // The same seed gives the same noise, restoring the state rewinds it.
+    GyroNoise other;
+    other.configure(options, quad_airframe(), 20000);
+    const auto state = other.get_state();
+    const auto first = other.sample(0, rpm);
+    other.sample(50, rpm);
+    other.set_state(state);
+    REQUIRE(other.sample(0, rpm) == first);
+}
+
+TEST_CASE("motor vibration follows the rpm", "[noise]") {
+    GyroNoise::Options options;
+    options.vibration_dps = 10;
+    options.harmonics = 1;
+
+    auto packet = quad_airframe();
+    packet.motor_count = 1;
+    GyroNoise noise;
+    noise.configure(options, packet, 20000);
+    REQUIRE(noise.enabled());
+
+    // 12000 rpm are 200 Hz, at a third of max rpm the amplitude is 1/9.
+    std::array<float, MaxMotors> rpm{};
+    rpm[0] = 12000;
+    auto crossings = 0;
+    auto peak = 0.0f;
+    auto last = noise.sample(0, rpm);
+    for (uint64_t now = 50; now <= 1000000; now += 50) {
+        const auto n = noise.sample(now, rpm);
+        if ((n[0] < 0) != (last[0] < 0)) crossings++;
+        peak = std::max(peak, length(n));
+        last = n;
+    }
+
+    REQUIRE(std::abs(crossings - 400) <= 2);
+    // Rocking around the diagonal plus a quarter of that in yaw.
+    REQUIRE(peak == Approx(10.0f / 9 * std::sqrt(1.0625f)).epsilon(0.01));
+
+    rpm[0] = 0;
+    REQUIRE(length(noise.sample(1000050, rpm)) == 0);
+}
@@ -0,0 +1,129 @@
+#include "catch.hpp"
+
+#include "osd.h"
+
+#include <array>
+#include <cstring>
+
+namespace {
+using Screen = std::array<uint8_t, OsdSize>;
+
+constexpr uint32_t AllRows = (1u << OsdRows) - 1;
+
+void write(Screen& screen, uint32_t x, uint32_t y, const char* s) {
+    std::memcpy(&screen[y * OsdColumns + x], s, std::strlen(s));
+}
+}  // namespace
+
+TEST_CASE("osd delta sends the changed cells", "[osd]") {
+    Screen screen{};
+    write(screen, 1, 1, "12.6V");
+    write(screen, 20, 14, "00:00");
+
+    OsdDelta delta;
+    std::array<uint8_t, MaxOsdDeltaSize> runs;
+    Screen game{};
+
+    const auto keyframe =
+      delta.keyframe(screen.data(), OsdColumns, runs.data());
+    REQUIRE(keyframe <= MaxOsdDeltaSize);
+    REQUIRE(OsdDelta::apply(runs.data(), keyframe, game.data(), OsdSize));
+    REQUIRE(game == screen);
+
+    // Nothing changed, even though betaflight redrew every row.
+    REQUIRE(delta.encode(screen.data(), OsdColumns, AllRows, runs.data()) ==
+            0u);
+
+    // The timer ticks, 01:02 is one run too since the two cells between the
+    // changes are shorter than a second run header.
+    for (const auto* timer : {"00:01", "01:02"}) {
+        write(screen, 20, 14, timer);
+        const auto len =
+          delta.encode(screen.data(), OsdColumns, 1u << 14, runs.data());
+        REQUIRE(len);
+        REQUIRE(*len <= 3 + 5);
+        REQUIRE(OsdDelta::apply(runs.data(), *len, game.data(), OsdSize));
+        REQUIRE(game == screen);
+    }
+
+    // Changes far apart are separate runs.
+    write(screen, 1, 1, "12.5V");
+    write(screen, 0, 3, "X");
+    const auto len =
+      delta.encode(screen.data(), OsdColumns, AllRows, runs.data());
+    REQUIRE(len == 2 * (3 + 1));
+    REQUIRE(OsdDelta::apply(runs.data(), *len, game.data(), OsdSize));
+    REQUIRE(game == screen);
+}
+
+TEST_CASE("osd delta falls back to a keyframe", "[osd]") {
+    Screen screen{};
+    OsdDelta delta;
+    std::array<uint8_t, MaxOsdDeltaSize> runs;
+    delta.keyframe(screen.data(), OsdColumns, runs.data());
+
+    // Every other cell changed, as long as a keyframe.
+    for (auto i = 0u; i < OsdSize; i += 2) screen[i] = 'A';
+    REQUIRE(!delta.encode(screen.data(), OsdColumns, AllRows, runs.data()));
+
+    const auto len = delta.keyframe(screen.data(), OsdColumns, runs.data());
+    Screen game{};
+    REQUIRE(OsdDelta::apply(runs.data(), len, game.data(), OsdSize));
+    REQUIRE(game == screen);
+
+    // Runs past the end of the screen are rejected.
+    const uint8_t bad[] = {0xFF, 0x01, 2, 'A', 'B'};
+    REQUIRE(!OsdDelta::apply(bad, sizeof(bad), game.data(), OsdSize));
+}
+
+TEST_CASE("osd delta on an hd canvas", "[osd]") {
+    // 53x20 in the rows of the largest canvas, as the fake display port.
+    std::array<uint8_t, MaxOsdSize> screen{};
+    const auto columns = 53u;
+    const auto rows = 20u;
+    OsdDelta delta(columns, rows);
+    REQUIRE(delta.size() == columns * rows);
+
+    std::array<uint8_t, MaxOsdDeltaSize> runs;
+    std::array<uint8_t, MaxOsdSize> game{};
+    for (auto y = 0u; y < rows; y++) screen[y * MaxOsdColumns + y] = 'A';
+    const auto len =
+      delta.keyframe(screen.data(), MaxOsdColumns, runs.data());
+    REQUIRE(len == columns * rows + 3 * 5);
+    REQUIRE(OsdDelta::apply(runs.data(), len, game.data(), delta.size()));
+    for (auto y = 0u; y < rows; y++) {
+        REQUIRE(game[y * columns + y] == 'A');
+    }
+
+    // The bottom right cell costs as much as on the small screen.
+    screen[19 * MaxOsdColumns + 52] = 'Z';
+    const auto delta_len =
+      delta.encode(screen.data(), MaxOsdColumns, 1u << 19, runs.data());
+    REQUIRE(delta_len == 3u + 1);
+    REQUIRE(OsdDelta::apply(runs.data(), 4, game.data(), delta.size()));
+    REQUIRE(game[19 * columns + 52] == 'Z');
+
+    // Outside of the canvas.
+    REQUIRE(!OsdDelta::apply(runs.data(), 4, game.data(), OsdSize));
+}
+
+TEST_CASE("osd delta packets are only as long as their cells",
+          "[osd][packets]") {
+    StateOsdDeltaPacket packet;
+    packet.sequence = 7;
+    packet.cells._len = 5;
+    const uint8_t run[] = {1, 0, 2, 'A', 'B'};
+    std::memcpy(&packet.cells.value[0], run, sizeof(run));
+
+    const auto size = send_size(packet);
+    REQUIRE(size == wire::StateOsdDeltaPacket::cells + 8 + 8);
+    REQUIRE(size < sizeof(StateOsdUpdatePacket) / 4);
+
+    std::array<std::byte, sizeof(StateOsdDeltaPacket)> data;
+    std::memcpy(data.data(), &packet, size);
+    const auto received = get<StateOsdDeltaPacket>(data.data(), size);
+    REQUIRE(received);
+    REQUIRE(received->sequence.value == 7);
+    REQUIRE(received->cells._len == 5);
+    REQUIRE(std::memcmp(&received->cells.value[0], run, sizeof(run)) == 0);
+}
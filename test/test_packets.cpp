@@ -48,6 +48,11 @@ TEST_CASE("packet send & receive", "[packets]") {
     send(send_socket, packet);
     REQUIRE(receive<FloatT>(recv_socket) == 12.0f);
 
+    IntT testI;
+    testI.value = -42;
+    send(send_socket, testI);
+    REQUIRE(receive<IntT>(recv_socket).value == -42);
+
     Vec3T testV;
     testV.value = {12.0f, 0.0f, -12.2e5f};
     send(send_socket, testV);
@@ -75,6 +80,14 @@ TEST_CASE("packet send & receive", "[packets]") {
     auto recv_state = receive<StatePacket>(recv_socket);
     REQUIRE(state.delta.value == recv_state.delta.value);
 
+    BatchStatePacket batch;
+    batch.frames.value = 3;
+    batch.rcData.value[8 * 2 + 1].value = 0.5f;
+    send(send_socket, batch);
+    auto recv_batch = receive<BatchStatePacket>(recv_socket);
+    REQUIRE(recv_batch.frames.value == 3);
+    REQUIRE(recv_batch.rcData.value[8 * 2 + 1].value == 0.5f);
+
     StateUpdatePacket update;
     update.linearVelocity.value[0] = -1234.0123f;
     update.linearVelocity.value[1] = 1234.0123f;
@@ -92,6 +105,11 @@ TEST_CASE("packet send & receive", "[packets]") {
     REQUIRE(recv_updateOsd.angularVelocity.value ==
             updateOsd.angularVelocity.value);
 
+    send(send_socket, state);
+    auto any = receive_any<BatchStatePacket, StatePacket>(recv_socket);
+    REQUIRE(any);
+    REQUIRE(std::holds_alternative<StatePacket>(*any));
+
     send_socket.send(reinterpret_cast<const std::byte*>("STOP"), 4);
     REQUIRE(receive<Vec3T, true>(recv_socket) == std::nullopt);
 
@@ -101,3 +119,33 @@ TEST_CASE("packet send & receive", "[packets]") {
     send_socket.send(reinterpret_cast<const std::byte*>("BBBB"), 4);
     REQUIRE(receive<Vec3T, false, true>(recv_socket) == std::nullopt);
 }
+
+TEST_CASE("wire layout", "[packets]") {
+    REQUIRE(wire::StatePacket::delta == 8);
+    REQUIRE(wire::StatePacket::position == 16);
+    REQUIRE(wire::StatePacket::rotation == 32);
+    REQUIRE(StatePacket::WireSize == sizeof(StatePacket));
+    REQUIRE(PoolByteArrayT<5>::WireSize == 16);
+}
+
+TEST_CASE("decode", "[packets]") {
+    StatePacket state;
+    state.delta.value = 0.5f;
+    state.rcData.value[3].value = -1.0f;
+    auto* data = reinterpret_cast<std::byte*>(&state);
+
+    StatePacket decoded;
+    REQUIRE(decode(data, sizeof(state), decoded));
+    REQUIRE(decoded.delta.value == 0.5f);
+    REQUIRE(decoded.rcData.value[3].value == -1.0f);
+
+    REQUIRE_FALSE(decode(data, sizeof(state) - 4, decoded));
+
+    // A 64 bit float is left to the field by field parser.
+    state.rcData.value[3]._typeId |= 1 << 16;
+    REQUIRE_FALSE(decode(data, sizeof(state), decoded));
+
+    state.rcData.value[3]._typeId = 2;
+    REQUIRE_FALSE(decode(data, sizeof(state), decoded));
+    REQUIRE_FALSE(get<StatePacket>(data, sizeof(state)));
+}
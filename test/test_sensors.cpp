@@ -0,0 +1,102 @@
+#include "catch.hpp"
+
+#include "sensors.h"
+
+#include <utility>
+#include <vector>
+
+TEST_CASE("sensor rates", "[sensors]") {
+    SensorPipeline sensors;
+    REQUIRE(sensors.set_timing(SensorPipeline::Baro, {50, 0}));
+    REQUIRE(sensors.set_timing(SensorPipeline::Gyro, {0, 0}));
+    REQUIRE(sensors.set_timing(SensorPipeline::Acc, {0, 0}));
+    REQUIRE(sensors.set_timing(SensorPipeline::Mag, {0, 0}));
+    REQUIRE(sensors.set_timing(SensorPipeline::Gps, {0, 0}));
+
+    // One simulated second of 50 us ticks.
+    auto samples = 0;
+    auto polls = 0;
+    SensorPipeline::Value value;
+    for (uint64_t now = 0; now < 1000000; now += 50) {
+        if (now < sensors.next_event()) continue;
+        polls++;
+
+        if (sensors.sample_due(SensorPipeline::Baro, now)) {
+            sensors.push(SensorPipeline::Baro, now, {double(now), 0, 0, 0});
+            samples++;
+        }
+        REQUIRE(sensors.pop(SensorPipeline::Baro, now, value));
+        REQUIRE(value[0] == double(now));
+        REQUIRE(!sensors.sample_due(SensorPipeline::Gyro, now));
+    }
+
+    REQUIRE(samples == 50);
+    REQUIRE(polls == 50);
+}
+
+TEST_CASE("sensor latency", "[sensors]") {
+    SensorPipeline sensors;
+    // Longer than the queue holds.
+    REQUIRE(!sensors.set_timing(SensorPipeline::Gps, {10, 800000}));
+    REQUIRE(sensors.get_timing(SensorPipeline::Gps).latency_us == 0);
+
+    REQUIRE(sensors.set_timing(SensorPipeline::Gps, {10, 250000}));
+
+    SensorPipeline::Value value;
+    std::vector<std::pair<uint64_t, double>> delivered;
+    for (uint64_t now = 0; now < 1000000; now += 1000) {
+        if (sensors.sample_due(SensorPipeline::Gps, now)) {
+            sensors.push(SensorPipeline::Gps, now, {double(now), 0, 0, 0});
+        }
+        if (sensors.pop(SensorPipeline::Gps, now, value)) {
+            delivered.emplace_back(now, value[0]);
+        }
+    }
+
+    // Samples every 100 ms, each seen 250 ms later.
+    REQUIRE(delivered.size() == 8);
+    for (auto i = 0u; i < delivered.size(); i++) {
+        REQUIRE(delivered[i].second == i * 100000.0);
+        REQUIRE(delivered[i].first == i * 100000 + 250000);
+    }
+
+    // Restoring the queue brings back the samples still in flight.
+    const auto state = sensors.get_state();
+    REQUIRE(sensors.pop(SensorPipeline::Gps, 2000000, value));
+    REQUIRE(!sensors.pop(SensorPipeline::Gps, 2000000, value));
+    sensors.set_state(state);
+    REQUIRE(sensors.pop(SensorPipeline::Gps, 2000000, value));
+    REQUIRE(value[0] == 900000.0);
+}
+
+TEST_CASE("sensor latency fills the queue", "[sensors]") {
+    SensorPipeline sensors;
+    const auto gyro = SensorPipeline::Gyro;
+    REQUIRE(!sensors.set_timing(gyro, {20000, 390}));
+    REQUIRE(!sensors.set_timing(gyro, {20000, 301}));
+
+    // The longest latency, with the polls on the period and with polls that
+    // take the samples late.
+    for (const auto& [rate, poll] : {std::pair{20000u, 50u}, {15000u, 50u}}) {
+        const auto latency =
+          (SensorPipeline::MaxInFlight - 2) * (1000000 / rate);
+        REQUIRE(sensors.set_timing(gyro, {rate, latency}));
+        sensors.set_state({});
+
+        SensorPipeline::Value value;
+        auto pushed = 0.0;
+        auto delivered = 0.0;
+        for (uint64_t now = 0; now < 100000; now += poll) {
+            if (sensors.sample_due(gyro, now)) {
+                REQUIRE(sensors.get_state()[gyro].size <
+                        SensorPipeline::MaxInFlight);
+                sensors.push(gyro, now, {pushed++, 0, 0, 0});
+            }
+            if (sensors.pop(gyro, now, value)) {
+                REQUIRE(value[0] >= delivered);
+                delivered = value[0];
+            }
+        }
+        REQUIRE(delivered > pushed - SensorPipeline::MaxInFlight);
+    }
+}
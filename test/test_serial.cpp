@@ -0,0 +1,50 @@
+#include "catch.hpp"
+
+#include <array>
+#include <cstdint>
+
+extern "C" {
+#include "dyad.h"
+}
+
+namespace bf {
+extern "C" {
+#include "drivers/serial.h"
+#include "drivers/serial_tcp.h"
+
+#include "src/target.h"
+}
+}  // namespace bf
+
+TEST_CASE("tcp serial flushes before reporting an empty tx buffer",
+          "[serial]") {
+    using namespace bf;
+
+    // The last UART, betaflight doesn't use it.
+    const auto id = SERIAL_PORT_COUNT - 1;
+    dyad_init();
+    dyad_setUpdateTimeout(0);
+    auto* port = serTcpOpen(
+      id, nullptr, nullptr, 115200, MODE_RXTX, SERIAL_NOT_INVERTED);
+    REQUIRE(port);
+
+    // A stream that is never connected stands in for the client.
+    std::array<tcpConnection_t, SERIAL_PORT_COUNT> connections;
+    tcpGetConnections(&connections[0]);
+    const auto saved = connections[id];
+    connections[id].conn = dyad_newStream();
+    tcpSetConnections(&connections[0]);
+
+    const uint8_t bytes[] = {'$', 'M', '>'};
+    for (const auto byte : bytes) {
+        port->vTable->serialWrite(port, byte);
+    }
+    REQUIRE(port->vTable->isSerialTransmitBufferEmpty(port));
+
+    port->vTable->writeBuf(port, bytes, int(sizeof(bytes)));
+    REQUIRE(port->vTable->isSerialTransmitBufferEmpty(port));
+
+    dyad_update();
+    connections[id] = saved;
+    tcpSetConnections(&connections[0]);
+}
@@ -0,0 +1,136 @@
+#include "catch.hpp"
+
+#include "mmsg_transport.h"
+#include "shm_transport.h"
+#include "transport.h"
+
+#include <cstdio>
+#include <memory>
+
+#ifdef __linux__
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+TEST_CASE("file transport", "[transport]") {
+    const auto trace = "test_trace.bin";
+    const auto recorded = "test_recorded.bin";
+
+    StatePacket state;
+    state.delta.value = 0.01f;
+
+    {
+        FileTransport writer("/dev/null", trace);
+        send(writer, state);
+        writer.send(reinterpret_cast<const std::byte*>("STOP"), 4);
+    }
+
+    {
+        auto reader = std::make_unique<FileTransport>(trace, nullptr);
+        REQUIRE(reader->valid());
+        RecordingTransport recorder(std::move(reader), recorded);
+        REQUIRE(recorder.valid());
+
+        auto packet = receive_any<StatePacket>(recorder);
+        REQUIRE(packet);
+        REQUIRE(std::get<StatePacket>(*packet).delta.value == 0.01f);
+
+        REQUIRE(receive_any<StatePacket>(recorder) == std::nullopt);
+        REQUIRE(receive_any<StatePacket>(recorder) == std::nullopt);
+    }
+
+    FileTransport replay(recorded, nullptr);
+    REQUIRE(replay.valid());
+    auto packet = receive_any<StatePacket>(replay);
+    REQUIRE(packet);
+    REQUIRE(std::get<StatePacket>(*packet).delta.value == 0.01f);
+    REQUIRE(receive_any<StatePacket>(replay) == std::nullopt);
+    REQUIRE_FALSE(replay.recv());
+
+    std::remove(trace);
+    std::remove(recorded);
+}
+
+#ifdef __linux__
+TEST_CASE("shared memory transport", "[transport]") {
+    ShmTransport simulator("/kwadsim_test", ShmTransport::Side::Simulator);
+    REQUIRE(simulator.valid());
+
+    {
+        ShmTransport game("/kwadsim_test", ShmTransport::Side::Game);
+        REQUIRE(game.valid());
+
+        StatePacket state;
+        for (auto i = 0; i < 10000; i++) {
+            state.delta.value = float(i);
+            send(game, state);
+
+            auto packet = receive_any<StatePacket>(simulator);
+            REQUIRE(packet);
+            REQUIRE(std::get<StatePacket>(*packet).delta.value == float(i));
+
+            send(*simulator, StateUpdatePacket{});
+            REQUIRE(receive_any<StateUpdatePacket>(game));
+        }
+    }
+
+    // The game closed its end.
+    REQUIRE_FALSE(simulator.recv());
+}
+
+TEST_CASE("shared memory transport in a forked child", "[transport]") {
+    auto simulator = std::make_unique<ShmTransport>(
+      "/kwadsim_test", ShmTransport::Side::Simulator);
+    REQUIRE(simulator->valid());
+
+    // The child destroys its copy, the segment stays with the parent.
+    const auto pid = fork();
+    if (pid == 0) {
+        simulator.reset();
+        _exit(0);
+    }
+    REQUIRE(pid > 0);
+    waitpid(pid, nullptr, 0);
+
+    {
+        ShmTransport game("/kwadsim_test", ShmTransport::Side::Game);
+        REQUIRE(game.valid());
+
+        send(*simulator, StateUpdatePacket{});
+        REQUIRE(receive_any<StateUpdatePacket>(game));
+    }
+}
+
+TEST_CASE("batched udp transport", "[transport]") {
+    MmsgTransport simulator(17790, 17791);
+    MmsgTransport game(17791, 17790);
+    REQUIRE(simulator.valid());
+    REQUIRE(game.valid());
+
+    StatePacket state;
+    for (auto i = 0; i < 5; i++) {
+        state.delta.value = float(i);
+        send(game, state);
+    }
+    game.flush();
+    REQUIRE(game.counters().syscalls == 1);
+
+    for (auto i = 0; i < 5; i++) {
+        auto packet = receive_any<StatePacket>(simulator);
+        REQUIRE(packet);
+        REQUIRE(std::get<StatePacket>(*packet).delta.value == float(i));
+        send(*simulator, StateUpdatePacket{});
+    }
+    REQUIRE(simulator.counters().syscalls == 1);
+    REQUIRE(simulator.counters().received == 5);
+
+    simulator.flush();
+    REQUIRE(simulator.counters().syscalls == 2);
+    REQUIRE(simulator.counters().sent == 5);
+
+    for (auto i = 0; i < 5; i++) {
+        REQUIRE(receive_any<StateUpdatePacket>(game));
+    }
+    REQUIRE(game.counters().syscalls == 2);
+}
+#endif
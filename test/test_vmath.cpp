@@ -36,4 +36,53 @@ TEST_CASE("general vector math", "[vmath]") {
     REQUIRE(xform_inv(identity, a) == a);
     REQUIRE(transpose(identity) == identity);
     REQUIRE(identity * rotate == rotate);
-}
\ No newline at end of file
+}
+
+TEST_CASE("quaternions", "[vmath]") {
+    const auto q = quat_exp({0.3f, 1.2f, -0.7f});
+    const auto m = quat_to_mat3(q);
+
+    // Round trip through the matrix.
+    const auto back = mat3_to_quat(m);
+    for (auto i = 0u; i < 4; i++) {
+        REQUIRE(back[i] == Approx(q[i]).margin(1e-6));
+    }
+
+    const vec3 v = {1, 2, 3};
+    const auto rotated = rotate(q, v);
+    const auto expected = xform(m, v);
+    const auto restored = rotate_inv(q, rotated);
+    for (auto i = 0u; i < 3; i++) {
+        REQUIRE(rotated[i] == Approx(expected[i]));
+        REQUIRE(restored[i] == Approx(v[i]));
+    }
+
+    // Composition matches the matrix product.
+    const auto p = quat_exp({0, 0, 0.5f});
+    const auto composed = quat_to_mat3(p * q);
+    const auto product = quat_to_mat3(p) * m;
+    for (auto i = 0u; i < 3; i++) {
+        for (auto j = 0u; j < 3; j++) {
+            REQUIRE(composed[i][j] == Approx(product[i][j]).margin(1e-6));
+        }
+    }
+
+    REQUIRE(quat_exp({0, 0, 0}) == quat_identity);
+
+    // A quarter turn around z.
+    const auto x = rotate(quat_exp({0, 0, float(M_PI) / 2}), {1, 0, 0});
+    REQUIRE(x[0] == Approx(0).margin(1e-6));
+    REQUIRE(x[1] == Approx(1));
+    REQUIRE(x[2] == Approx(0).margin(1e-6));
+
+    // Small steps follow the exponential map.
+    auto integrated = quat_identity;
+    const vec3 w = {0.5f, -1, 2};
+    for (auto k = 0; k < 1000; k++) {
+        integrated = integrate(integrated, w, 1e-3f);
+    }
+    const auto exact = quat_exp(w);
+    for (auto i = 0u; i < 4; i++) {
+        REQUIRE(integrated[i] == Approx(exact[i]).margin(1e-4));
+    }
+}